@@ -3,77 +3,2114 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/uaccess.h>  
+#include <linux/uio.h>
 #include <linux/device.h> 
 #include <linux/slab.h>  
+#include <linux/mempool.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/cred.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/eventfd.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/xarray.h>
+#include <linux/scatterlist.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <crypto/algapi.h>
+#include <crypto/skcipher.h>
+
+#include "aes_core.h"
+#include "aes_armor.h"
+#include "vencrypt.h"
+
+#define CREATE_TRACE_POINTS
+#include "kaes_trace.h"
 
 #define DEVICE_NAME_CT "aes_ct" // decypher text
 #define DEVICE_NAME_CD "aes_cd" // cypher data
-#define BUFFER_SIZE 256
+#define RANGE_CHUNK (64 * 1024) // PROCESS_RANGE work between reschedule points
+#define PARALLEL_MIN_CHUNK (16 * 1024) // smaller slices cost more to hand off than to cipher
+#define KCAPI_SG_PAGES 16 // scatterlist entries per crypto API request
+#define STATS_BUCKETS 32 // log2 latency buckets, 1 ns up to 2^31 ns and beyond
+#define ARMOR_CHUNK 192 // ciphertext bytes per armor pass, whole hex and base64 groups
+#define USER_PIN_PAGES 32 // caller pages PROCESS_USER pins and maps at a time
+
+enum text_mode {
+    MODE_CBC,
+    MODE_CTR,
+    MODE_GCM,
+    MODE_XTS,
+};
+
+static const char * const mode_names[] = {
+    [MODE_CBC] = "cbc",
+    [MODE_CTR] = "ctr",
+    [MODE_GCM] = "gcm",
+    [MODE_XTS] = "xts",
+};
+
+static const char * const armor_names[] = {
+    [VENCRYPT_ARMOR_NONE] = "none",
+    [VENCRYPT_ARMOR_HEX] = "hex",
+    [VENCRYPT_ARMOR_BASE64] = "base64",
+};
+
+// Crypto API algorithms for the kcapi backend; GCM streams always use aes_gcm.c
+static const char * const kcapi_names[] = {
+    [MODE_CBC] = "cbc(aes)",
+    [MODE_CTR] = "ctr(aes)",
+    [MODE_XTS] = "xts(aes)",
+};
+
+/*
+ * Key material, expanded once when it is set and never changed after that.
+ * The device, sessions and the key table share it by reference.
+ */
+struct text_key {
+    struct aes_ctx ctx;    // schedules first, cache aligned by text_key_cache
+    struct aes_xts_ctx xts;
+    u8 key[2 * AES_MAX_KEY_SIZE];
+    unsigned int key_len;  // 0 until a key is set
+    bool xts_ready;        // key splits into XTS data and tweak keys
+    struct kref ref;
+    u32 handle;            // 0 unless the key is in the table
+    struct list_head lru;  // table keys, most recently used first
+    kuid_t owner;          // euid of the loader; only it can use the handle
+};
+
+struct text_device {
+    struct cdev cdev;
+    dev_t dev_number;
+    struct class *dev_class;
+    struct device *device;
+    struct mutex lock;     // key and mode against concurrent sysfs writes and opens
+    struct text_key *key;  // from sysfs, shared with each new session
+    int mode;              // enum text_mode, default for new sessions
+    int armor;             // VENCRYPT_ARMOR_*, default for new sessions
+    int status;
+};
+
+/*
+ * Async rings of a session. The worker runs in the submitter's mm so it can
+ * copy from and to the user pointers in the SQEs.
+ */
+struct text_async {
+    struct work_struct work;
+    struct text_session *sess;
+    struct mm_struct *mm;
+    struct eventfd_ctx *eventfd;  // may be NULL
+    void *area;                   // shared with userspace
+    struct vencrypt_async_ring *ring;
+    struct vencrypt_sqe *sqes;
+    struct vencrypt_cqe *cqes;
+    size_t size;
+    u32 sq_entries, cq_entries;
+    u32 sq_head, cq_tail;         // the kernel's own copies; the shared ones are only published
+};
+
+// What a crypto API request points at, kept until it completes
+struct text_kcapi_io {
+    struct scatterlist sg[KCAPI_SG_PAGES];
+    u8 iv[AES_BLOCK_SIZE];    // the driver's copy; not every driver hands the next IV back
+    u8 next[AES_BLOCK_SIZE];  // CBC decryption chains on ciphertext about to be overwritten
+};
+
+/*
+ * One per open(). Sessions share nothing, so independent streams run
+ * concurrently; the lock only serializes threads sharing one file.
+ */
+struct text_session {
+    struct mutex lock;
+    wait_queue_head_t wait; // readers and writers blocked on the stream
+    u32 id;                // names the session in tracepoints
+    struct text_key *key;  // the device key at open, one from SET_KEY or a table key
+    u8 iv[AES_BLOCK_SIZE]; // CBC chain value, CTR counter or XTS sector number
+    int mode;              // enum text_mode
+    int encrypt;           // from the module parameter or ioctl
+    /*
+     * Stream cursors, in bytes since open; the ring index is the cursor
+     * modulo ring_size. tail <= out <= done <= head, and the bytes between
+     * done and head are a partial unit carried over to the next write.
+     */
+    u8 *ring;
+    size_t head;           // written
+    size_t done;           // run through the cipher
+    size_t out;            // released to the reader
+    size_t tail;           // read
+    bool finished;         // padding or GCM tag done, no more data
+    struct aes_gcm_ctx gcm;
+    bool gcm_ready;        // GCM nonce set for this stream
+    bool verified;         // GCM decrypt output may be read
+    /*
+     * Text armor of the ciphertext side: encoded on the way out of an
+     * encrypting stream, decoded on the way into a decrypting one.
+     */
+    int armor;             // VENCRYPT_ARMOR_*
+    char armor_in[4];      // decrypt: characters of an incomplete group
+    char armor_out[4];     // encrypt: the rest of a group a read had no room for
+    unsigned int armor_in_len, armor_out_len;
+    bool armor_ended;      // base64 padding seen, no more input
+    struct text_async *async;
+    struct crypto_skcipher *tfm; // kcapi backend only, else NULL
+    /*
+     * kcapi stream requests, one in flight at a time on a request allocated
+     * with the transform: req_len bytes after done are with the driver, and
+     * once they complete kcapi_work moves done on and sends the next chunk,
+     * up to req_end.
+     */
+    struct skcipher_request *req;
+    struct text_kcapi_io io;
+    struct work_struct kcapi_work;
+    size_t req_end;
+    unsigned int req_len;
+    int req_err;           // completion status, for kcapi_work
+    u64 req_start;
+    int error;             // a request failed; the stream is dead
+};
+
+// Where a request spends its time, one latency histogram each
+enum text_stage {
+    STAGE_COPY_IN,
+    STAGE_CIPHER,
+    STAGE_COPY_OUT,
+    NR_STAGES,
+};
+
+static const char * const stage_names[] = {
+    [STAGE_COPY_IN] = "copy_in",
+    [STAGE_CIPHER] = "cipher",
+    [STAGE_COPY_OUT] = "copy_out",
+};
+
+/*
+ * Counters of one CPU, bumped with this_cpu ops and so without locks or
+ * shared cache lines. Readers sum every CPU; the totals are a snapshot,
+ * not a consistent cut across counters.
+ */
+struct text_stats {
+    u64 bytes_in[ARRAY_SIZE(mode_names)];   // taken from userspace
+    u64 bytes_out[ARRAY_SIZE(mode_names)];  // handed back
+    u64 ops[ARRAY_SIZE(mode_names)];        // reads, writes, ranges and batch items
+    u64 errors[ARRAY_SIZE(mode_names)];
+    u64 latency[NR_STAGES][STATS_BUCKETS];  // bucket i: [2^i, 2^(i+1)) ns
+};
+
+// A slice of a parallel text_cipher() call and the IV it starts from
+struct text_chunk {
+    struct work_struct work;
+    const struct text_session *sess;
+    u8 *data;
+    unsigned int len;
+    u8 iv[AES_BLOCK_SIZE];
+};
+
+static struct text_device *my_device;
+static struct workqueue_struct *text_wq;
+static struct kmem_cache *text_key_cache;
+static struct kmem_cache *text_session_cache;
+static struct kmem_cache *text_bounce_cache;
+static mempool_t *text_bounce_pool;
+static struct kmem_cache *text_chunks_cache;  // one text_chunk per possible CPU
+static DEFINE_PER_CPU(struct text_stats, text_stats);
+static struct dentry *text_debugfs;
+static atomic_t text_session_ids;
+
+/*
+ * Tenant keys, loaded once and switched between by handle from any open of
+ * the same user. A handle only works for the euid that loaded it; the key
+ * stays in the table across opens, bounded by key_cache_size, and loading
+ * past that evicts the least recently used keys. Sessions still on an
+ * evicted key keep their reference, only the handle goes away.
+ */
+static DEFINE_XARRAY_ALLOC1(text_keys);
+static LIST_HEAD(text_key_lru);
+static DEFINE_MUTEX(text_keys_lock);
+static unsigned int text_keys_count;
+static u32 text_keys_next;
+
+/*
+ * Rings of closed sessions, wiped, for the next opens: vmalloc_user()
+ * allocates and maps every page, the most expensive part of an open.
+ */
+static void **text_rings;
+static unsigned int text_rings_count;
+static DEFINE_MUTEX(text_rings_lock);
+
+static int encrypt = 1;
+module_param(encrypt, int, 0644);
+MODULE_PARM_DESC(encrypt, "1 to encrypt (default), 0 to decrypt");
+
+static char *impl = "auto";
+module_param(impl, charp, 0444);
+MODULE_PARM_DESC(impl, "AES backend: auto (default), aesni, ce, bitslice or generic");
+
+static char *backend = "builtin";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "Stream cipher code: builtin (default) or kcapi, the kernel crypto API's cbc/ctr/xts(aes)");
+
+static int xts_sector_size = 512;
+module_param(xts_sector_size, int, 0444);
+MODULE_PARM_DESC(xts_sector_size, "XTS data unit in bytes, a power of two from 512 (default) to 4096");
+
+static unsigned int ring_size = 65536;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Stream buffer in bytes, a power of two no smaller than xts_sector_size (default 65536)");
+
+static unsigned int parallel_threshold = 65536;
+module_param(parallel_threshold, uint, 0644);
+MODULE_PARM_DESC(parallel_threshold, "Spread CTR, XTS and CBC decryption of at least this many bytes over all CPUs, 0 for never (default 65536)");
+
+static unsigned int queue_depth;
+module_param(queue_depth, uint, 0444);
+MODULE_PARM_DESC(queue_depth, "Bytes a stream buffers before writers block, xts_sector_size up to ring_size (default 0, all of ring_size)");
+
+static unsigned int bounce_size = 65536;
+module_param(bounce_size, uint, 0444);
+MODULE_PARM_DESC(bounce_size, "Bytes per batch and async item buffer, the largest item they take, no smaller than xts_sector_size (default 65536)");
+
+static unsigned int bounce_reserve = 4;
+module_param(bounce_reserve, uint, 0444);
+MODULE_PARM_DESC(bounce_reserve, "Item buffers held back for when memory is short, at least 1 (default 4)");
+
+static unsigned int ring_cache = 16;
+module_param(ring_cache, uint, 0444);
+MODULE_PARM_DESC(ring_cache, "Stream buffers of closed sessions kept for the next opens (default 16)");
+
+static unsigned int key_cache_size = 4096;
+module_param(key_cache_size, uint, 0644);
+MODULE_PARM_DESC(key_cache_size, "Keys the handle table holds before it evicts the least recently used (default 4096)");
+
+/*
+ * Accounts one request in @mode that returned @ret, with @in bytes copied
+ * from userspace and @out copied back. Waits that were cut short are not
+ * errors.
+ */
+static void text_stat_op(int mode, long ret, size_t in, size_t out) {
+    this_cpu_inc(text_stats.ops[mode]);
+    if (ret < 0 && ret != -EAGAIN && ret != -ERESTARTSYS)
+        this_cpu_inc(text_stats.errors[mode]);
+    if (in)
+        this_cpu_add(text_stats.bytes_in[mode], in);
+    if (out)
+        this_cpu_add(text_stats.bytes_out[mode], out);
+}
+
+// Adds the time since @start, from ktime_get_ns(), to a stage's histogram
+static void text_stat_time(enum text_stage stage, u64 start) {
+    u64 ns = ktime_get_ns() - start;
+
+    this_cpu_inc(text_stats.latency[stage][ns ? min_t(unsigned int, ilog2(ns), STATS_BUCKETS - 1) : 0]);
+}
+
+static struct text_key *text_key_alloc(void) {
+    struct text_key *key = kmem_cache_zalloc(text_key_cache, GFP_KERNEL);
+
+    if (key) {
+        kref_init(&key->ref);
+        INIT_LIST_HEAD(&key->lru);
+    }
+    return key;
+}
+
+static void text_key_release(struct kref *ref) {
+    struct text_key *key = container_of(ref, struct text_key, ref);
+
+    // kmem_cache_free() leaves the contents; key material must not linger
+    memzero_explicit(key, sizeof(*key));
+    kmem_cache_free(text_key_cache, key);
+}
+
+static void text_key_put(struct text_key *key) {
+    kref_put(&key->ref, text_key_release);
+}
+
+// Takes a key out of the table; text_keys_lock held
+static void text_key_unlink(struct text_key *key) {
+    xa_erase(&text_keys, key->handle);
+    list_del_init(&key->lru);
+    text_keys_count--;
+    text_key_put(key);
+}
+
+/*
+ * Adds an expanded key to the table, which takes over the caller's
+ * reference. key_cache_size may have been lowered since the last load, so
+ * as many keys go as it takes to make room.
+ */
+static int text_key_insert(struct text_key *key, u32 *handle) {
+    unsigned int limit;
+    int ret;
+
+    mutex_lock(&text_keys_lock);
+    limit = max_t(unsigned int, READ_ONCE(key_cache_size), 1);
+    while (text_keys_count >= limit)
+        text_key_unlink(list_last_entry(&text_key_lru, struct text_key, lru));
+
+    ret = xa_alloc_cyclic(&text_keys, &key->handle, key, xa_limit_32b, &text_keys_next, GFP_KERNEL);
+    if (ret >= 0) {
+        list_add(&key->lru, &text_key_lru);
+        key->owner = current_euid();
+        text_keys_count++;
+        *handle = key->handle;
+        ret = 0;
+    }
+    mutex_unlock(&text_keys_lock);
+
+    if (ret < 0)
+        text_key_put(key);
+    return ret;
+}
+
+// Keys another user loaded look the same as ones that aren't there
+static struct text_key *text_key_lookup(u32 handle) {
+    struct text_key *key = xa_load(&text_keys, handle);
+
+    return key && uid_eq(key->owner, current_euid()) ? key : NULL;
+}
+
+// A new reference to the key behind @handle, which becomes the most recently used
+static struct text_key *text_key_get(u32 handle) {
+    struct text_key *key;
+
+    mutex_lock(&text_keys_lock);
+    key = text_key_lookup(handle);
+    if (key) {
+        kref_get(&key->ref);
+        list_move(&key->lru, &text_key_lru);
+    }
+    mutex_unlock(&text_keys_lock);
+    return key;
+}
+
+static int text_key_drop(u32 handle) {
+    struct text_key *key;
+
+    mutex_lock(&text_keys_lock);
+    key = text_key_lookup(handle);
+    if (key)
+        text_key_unlink(key);
+    mutex_unlock(&text_keys_lock);
+    return key ? 0 : -ENOENT;
+}
+
+static void text_keys_destroy(void) {
+    struct text_key *key, *tmp;
+
+    list_for_each_entry_safe(key, tmp, &text_key_lru, lru)
+        text_key_unlink(key);
+    xa_destroy(&text_keys);
+}
+
+// A 32-byte key serves as AES-256 or XTS-AES-128; longer ones are XTS only
+static bool text_key_ready(const struct text_session *sess) {
+    if (sess->mode == MODE_XTS)
+        return sess->key->xts_ready;
+    return sess->key->key_len && sess->key->key_len <= AES_MAX_KEY_SIZE;
+}
+
+// Which code ciphers the session's data, for tracepoints
+static const char *text_backend_name(const struct text_session *sess) {
+    const struct aes_impl *impl = sess->mode == MODE_XTS ? sess->key->xts.crypt.impl : sess->key->ctx.impl;
+
+    if (sess->tfm)
+        return "kcapi";
+    return impl ? impl->name : aes_core_impl_name();
+}
+
+// Hands the session key to its crypto API transform, once there is a usable one
+static int text_kcapi_setkey(struct text_session *sess) {
+    if (!sess->tfm || !text_key_ready(sess))
+        return 0;
+    return crypto_skcipher_setkey(sess->tfm, sess->key->key, sess->key->key_len);
+}
+
+// Stream data written under the current key is still to go through the driver
+static bool text_kcapi_busy(const struct text_session *sess) {
+    return READ_ONCE(sess->req_len) || READ_ONCE(sess->done) < READ_ONCE(sess->req_end);
+}
+
+// Switches the session to @key, taking over the caller's reference
+static int text_use_key(struct text_session *sess, struct text_key *key) {
+    struct text_key *old = sess->key;
+    int ret;
+
+    if (text_kcapi_busy(sess)) {
+        text_key_put(key);
+        return -EBUSY;
+    }
+
+    sess->key = key;
+    ret = text_kcapi_setkey(sess);
+    if (ret < 0) {
+        sess->key = old;
+        text_key_put(key);
+        return ret;
+    }
+
+    text_key_put(old);
+    // A GCM hash key derived from the old key is stale now
+    sess->gcm_ready = false;
+    return 0;
+}
+
+static u8 *text_ring_alloc(void) {
+    u8 *ring = NULL;
+
+    mutex_lock(&text_rings_lock);
+    if (text_rings_count)
+        ring = text_rings[--text_rings_count];
+    mutex_unlock(&text_rings_lock);
+
+    // vmalloc_user() so the same buffer can be mmap()ed
+    return ring ?: vmalloc_user(ring_size);
+}
+
+static void text_ring_free(u8 *ring) {
+    // Plaintext must not linger in freed memory, and a reused ring starts zeroed like a new one
+    memzero_explicit(ring, ring_size);
+
+    mutex_lock(&text_rings_lock);
+    if (text_rings_count < ring_cache) {
+        text_rings[text_rings_count++] = ring;
+        ring = NULL;
+    }
+    mutex_unlock(&text_rings_lock);
+    vfree(ring);
+}
+
+static void text_rings_destroy(void) {
+    while (text_rings_count)
+        vfree(text_rings[--text_rings_count]);
+    kfree(text_rings);
+}
+
+// The session holds the GCM state and CBC chain value, so it is wiped like a key
+static void text_session_free(struct text_session *sess) {
+    memzero_explicit(sess, sizeof(*sess));
+    kmem_cache_free(text_session_cache, sess);
+}
+
+static void text_kcapi_work(struct work_struct *work);
+
+static int text_open(struct inode *inode, struct file *file) {
+    struct text_device *dev = container_of(inode->i_cdev, struct text_device, cdev);
+    struct text_session *sess;
+    int ret;
+
+    sess = kmem_cache_zalloc(text_session_cache, GFP_KERNEL);
+    if (!sess)
+        return -ENOMEM;
+
+    sess->ring = text_ring_alloc();
+    if (!sess->ring) {
+        ret = -ENOMEM;
+        goto fail_ring;
+    }
+
+    // Each open starts a new stream with an all-zero IV / counter; GCM needs SET_IV
+    mutex_init(&sess->lock);
+    init_waitqueue_head(&sess->wait);
+    sess->id = atomic_inc_return(&text_session_ids);
+    sess->encrypt = encrypt;
+    // The key is shared, not copied: open never expands a schedule
+    mutex_lock(&dev->lock);
+    kref_get(&dev->key->ref);
+    sess->key = dev->key;
+    sess->mode = dev->mode;
+    sess->armor = dev->armor;
+    mutex_unlock(&dev->lock);
+
+    // The crypto API picks its best driver for this mode, possibly an async one
+    if (!strcmp(backend, "kcapi") && kcapi_names[sess->mode]) {
+        sess->tfm = crypto_alloc_skcipher(kcapi_names[sess->mode], 0, 0);
+        if (IS_ERR(sess->tfm)) {
+            ret = PTR_ERR(sess->tfm);
+            goto fail_tfm;
+        }
+        sess->req = skcipher_request_alloc(sess->tfm, GFP_KERNEL);
+        if (!sess->req) {
+            ret = -ENOMEM;
+            goto fail_req;
+        }
+        INIT_WORK(&sess->kcapi_work, text_kcapi_work);
+        ret = text_kcapi_setkey(sess);
+        if (ret < 0)
+            goto fail_setkey;
+    }
+
+    file->private_data = sess; 
+    // A pipe, not a file: reads and writes ignore the file position
+    stream_open(inode, file);
+    trace_kaes_open(sess->id, sess->mode, text_backend_name(sess));
+    return 0;
+
+fail_setkey:
+    skcipher_request_free(sess->req);
+fail_req:
+    crypto_free_skcipher(sess->tfm);
+fail_tfm:
+    text_key_put(sess->key);
+    text_ring_free(sess->ring);
+fail_ring:
+    text_session_free(sess);
+    return ret;
+}
+
+static void text_async_free(struct text_async *as) {
+    if (!as)
+        return;
+
+    cancel_work_sync(&as->work);
+    if (as->eventfd)
+        eventfd_ctx_put(as->eventfd);
+    mmdrop(as->mm);
+    vfree(as->area);
+    kfree(as);
+}
+
+// Nothing more is sent, and the request in flight, if any, is waited out
+static void text_kcapi_stop(struct text_session *sess) {
+    if (!sess->req)
+        return;
+
+    mutex_lock(&sess->lock);
+    sess->req_end = sess->done;
+    mutex_unlock(&sess->lock);
+    wait_event(sess->wait, !READ_ONCE(sess->req_len));
+    cancel_work_sync(&sess->kcapi_work);
+    skcipher_request_free(sess->req);
+}
+
+static int text_release(struct inode *inode, struct file *file) {
+    struct text_session *sess = file->private_data;
+
+    trace_kaes_release(sess->id, sess->mode, text_backend_name(sess));
+    text_async_free(sess->async);
+    text_kcapi_stop(sess);
+    crypto_free_skcipher(sess->tfm);
+    text_key_put(sess->key);
+    text_ring_free(sess->ring);
+    text_session_free(sess);
+    return 0;
+}
+
+// Stream bytes that can still be written before the queue is full
+static size_t text_space(const struct text_session *sess) {
+    return (queue_depth ?: ring_size) - (READ_ONCE(sess->head) - READ_ONCE(sess->tail));
+}
+
+// The armor of what read() hands out and of what write() takes, VENCRYPT_ARMOR_NONE for raw bytes
+static int text_armor_out(const struct text_session *sess) {
+    return sess->encrypt ? sess->armor : VENCRYPT_ARMOR_NONE;
+}
+
+static int text_armor_in(const struct text_session *sess) {
+    return sess->encrypt ? VENCRYPT_ARMOR_NONE : sess->armor;
+}
+
+// Bytes per armor group, and characters they encode to
+static unsigned int text_armor_raw(int armor) {
+    return armor == VENCRYPT_ARMOR_BASE64 ? 3 : 1;
+}
+
+static unsigned int text_armor_chars(int armor) {
+    return armor == VENCRYPT_ARMOR_BASE64 ? 4 : 2;
+}
+
+// Output the reader can take now; base64 goes in whole groups until the stream ends
+static size_t text_avail(const struct text_session *sess) {
+    size_t n = READ_ONCE(sess->out) - READ_ONCE(sess->tail);
+
+    if (text_armor_out(sess) == VENCRYPT_ARMOR_BASE64 && !READ_ONCE(sess->finished))
+        n = rounddown(n, 3);
+    return n;
+}
+
+// GCM plaintext is held back until its tag checks out
+static bool text_withheld(const struct text_session *sess) {
+    return sess->mode == MODE_GCM && !sess->encrypt && !READ_ONCE(sess->verified);
+}
+
+/*
+ * The wait conditions. They are also checked without the lock from the
+ * wait queue, so they only read each cursor once; the caller rechecks with
+ * the lock held. A finished stream is always ready: reads see EOF or an
+ * error and writes fail, instead of sleeping forever.
+ */
+static bool text_readable(const struct text_session *sess) {
+    return READ_ONCE(sess->finished) || READ_ONCE(sess->error) ||
+           ((text_avail(sess) || READ_ONCE(sess->armor_out_len)) && !text_withheld(sess));
+}
+
+// Armored input needs room for a whole decoded group
+static bool text_has_room(const struct text_session *sess) {
+    int armor = text_armor_in(sess);
+
+    return text_space(sess) >= (armor ? text_armor_raw(armor) : 1);
+}
+
+/*
+ * A GCM decrypt stream whose withheld plaintext fills the queue: nothing
+ * can drain it before CHECK_TAG, so writes fail instead of waiting.
+ */
+static bool text_stalled(const struct text_session *sess) {
+    return text_withheld(sess) && !text_has_room(sess);
+}
+
+static bool text_writable(const struct text_session *sess) {
+    return READ_ONCE(sess->finished) || READ_ONCE(sess->error) || text_has_room(sess) || text_stalled(sess);
+}
+
+/*
+ * Before fsync() can end the stream, leftover armor characters need room to
+ * decode into and CBC encryption needs room for its padding. kcapi streams
+ * also wait for the driver, so the end runs on settled cursors.
+ */
+static bool text_finishable(const struct text_session *sess) {
+    size_t left = READ_ONCE(sess->head) - READ_ONCE(sess->done);
+
+    if (READ_ONCE(sess->finished) || READ_ONCE(sess->error))
+        return true;
+    if (text_kcapi_busy(sess))
+        return false;
+    if (text_space(sess) < READ_ONCE(sess->armor_in_len))
+        return false;
+    if (sess->mode != MODE_CBC || !sess->encrypt)
+        return true;
+    return text_space(sess) >= AES_BLOCK_SIZE - left;
+}
+
+/*
+ * Sleeps until @ready holds, with sess->lock dropped meanwhile; entered and
+ * left with it held. -EAGAIN instead of sleeping for O_NONBLOCK files.
+ */
+static int text_wait(struct text_session *sess, struct file *file, bool (*ready)(const struct text_session *)) {
+    int ret;
+
+    while (!ready(sess)) {
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        mutex_unlock(&sess->lock);
+        ret = wait_event_interruptible(sess->wait, ready(sess));
+        mutex_lock(&sess->lock);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+// Copies @len bytes out of the ring from cursor @at, in two parts if it wraps
+static void text_ring_get(const struct text_session *sess, size_t at, u8 *dst, size_t len) {
+    size_t pos = at & (ring_size - 1);
+    size_t n = min_t(size_t, len, ring_size - pos);
+
+    memcpy(dst, sess->ring + pos, n);
+    memcpy(dst + n, sess->ring, len - n);
+}
+
+// Appends @len bytes at head, which the caller has checked there is room for
+static void text_ring_put(struct text_session *sess, const u8 *src, size_t len) {
+    size_t pos = sess->head & (ring_size - 1);
+    size_t n = min_t(size_t, len, ring_size - pos);
+
+    memcpy(sess->ring + pos, src, n);
+    memcpy(sess->ring, src + n, len - n);
+    sess->head += len;
+}
+
+// Only hands out bytes that went through the cipher
+static ssize_t text_read_raw(struct text_session *sess, struct iov_iter *to) {
+    size_t count = min_t(size_t, iov_iter_count(to), sess->out - sess->tail);
+    size_t copied = 0;
+    ssize_t ret = 0;
+
+    // Up to two copies: to the end of the ring, then from its start
+    while (copied < count) {
+        size_t pos = sess->tail & (ring_size - 1);
+        size_t n = min_t(size_t, count - copied, ring_size - pos);
+        size_t c = copy_to_iter(sess->ring + pos, n, to);
+
+        sess->tail += c;
+        copied += c;
+        if (c < n) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+    return copied ? copied : ret;
+}
+
+/*
+ * Hands out ciphertext as hex or base64, encoded a chunk at a time on the
+ * stack. A group is read from the ring as soon as any of its characters
+ * is copied out; the rest of it waits in armor_out for the next read.
+ */
+static ssize_t text_read_armor(struct text_session *sess, struct iov_iter *to) {
+    unsigned int raw = text_armor_raw(sess->armor), chars = text_armor_chars(sess->armor);
+    u8 data[ARMOR_CHUNK];
+    char text[2 * ARMOR_CHUNK];
+    size_t copied = 0, n, len, want, c;
+    ssize_t ret = 0;
+
+    if (sess->armor_out_len) {
+        want = min_t(size_t, iov_iter_count(to), sess->armor_out_len);
+        c = copy_to_iter(sess->armor_out, want, to);
+        sess->armor_out_len -= c;
+        memmove(sess->armor_out, sess->armor_out + c, sess->armor_out_len);
+        copied += c;
+        if (c < want)
+            return copied ? copied : -EFAULT;
+    }
+
+    while (iov_iter_count(to)) {
+        n = min3(text_avail(sess), (size_t)ARMOR_CHUNK, DIV_ROUND_UP(iov_iter_count(to), chars) * raw);
+        if (!n)
+            break;
+
+        text_ring_get(sess, sess->tail, data, n);
+        if (sess->armor == VENCRYPT_ARMOR_HEX) {
+            armor_hex_encode(text, data, n);
+            len = 2 * n;
+        } else {
+            len = armor_base64_encode(text, data, n);
+        }
+
+        want = min_t(size_t, len, iov_iter_count(to));
+        c = copy_to_iter(text, want, to);
+        copied += c;
+        sess->tail += min_t(size_t, DIV_ROUND_UP(c, chars) * raw, n);
+        if (c % chars) {
+            sess->armor_out_len = chars - c % chars;
+            memcpy(sess->armor_out, text + c, sess->armor_out_len);
+        }
+        if (c < want) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+    return copied ? copied : ret;
+}
+
+static ssize_t text_read_locked(struct text_session *sess, struct file *file, struct iov_iter *to) {
+    u64 start;
+    ssize_t ret;
+
+    if (!iov_iter_count(to))
+        return 0;
+
+    // Like a pipe: block until there is output, 0 once the stream has ended
+    ret = text_wait(sess, file, text_readable);
+    if (ret < 0)
+        return ret;
+    if (sess->error)
+        return sess->error;
+
+    // A GCM stream that ended without its tag checking out
+    if (text_withheld(sess))
+        return -EBADMSG;
+
+    start = ktime_get_ns();
+    if (text_armor_out(sess))
+        ret = text_read_armor(sess, to);
+    else
+        ret = text_read_raw(sess, to);
+    text_stat_time(STAGE_COPY_OUT, start);
+    return ret;
+}
+
+// Smallest amount of data the current mode can process on its own
+static unsigned int text_unit(const struct text_session *sess) {
+    return sess->mode == MODE_XTS ? xts_sector_size : AES_BLOCK_SIZE;
+}
+
+// Adds @n to a 128-bit counter: big-endian for CTR, little-endian for XTS sector numbers
+static void text_iv_add(u8 *iv, u64 n, bool be) {
+    unsigned int i, j;
+
+    for (i = 0; i < AES_BLOCK_SIZE && n; i++) {
+        j = be ? AES_BLOCK_SIZE - 1 - i : i;
+        n += iv[j];
+        iv[j] = (u8)n;
+        n >>= 8;
+    }
+}
+
+// Maps @len bytes at @data, vmalloc()ed or not, to at most KCAPI_SG_PAGES entries
+static void text_kcapi_sg(struct scatterlist *sg, u8 *data, unsigned int len) {
+    struct scatterlist *s = sg;
+    unsigned int n;
+
+    sg_init_table(sg, DIV_ROUND_UP(offset_in_page(data) + len, PAGE_SIZE));
+    for (; len; s = sg_next(s)) {
+        n = min_t(unsigned int, len, PAGE_SIZE - offset_in_page(data));
+        sg_set_page(s, is_vmalloc_addr(data) ? vmalloc_to_page(data) : virt_to_page(data),
+                    n, offset_in_page(data));
+        data += n;
+        len -= n;
+    }
+}
+
+// Bytes per crypto API request; an XTS request is a single data unit to it, so XTS goes a sector each
+static unsigned int text_kcapi_step(const struct text_session *sess) {
+    return sess->mode == MODE_XTS ? xts_sector_size : (KCAPI_SG_PAGES - 1) * PAGE_SIZE;
+}
+
+// Sends @n bytes at @data through the session's request, starting from @iv
+static int text_kcapi_start(const struct text_session *sess, struct text_kcapi_io *io, const u8 *iv,
+                            u8 *data, unsigned int n) {
+    if (sess->mode == MODE_CBC && !sess->encrypt)
+        memcpy(io->next, data + n - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+    memcpy(io->iv, iv, AES_BLOCK_SIZE);
+    text_kcapi_sg(io->sg, data, n);
+    skcipher_request_set_crypt(sess->req, io->sg, io->sg, n, io->iv);
+    return sess->encrypt ? crypto_skcipher_encrypt(sess->req) : crypto_skcipher_decrypt(sess->req);
+}
+
+// Moves @iv past the @n bytes at @data that a request has completed
+static void text_kcapi_advance(const struct text_session *sess, const struct text_kcapi_io *io, u8 *iv,
+                               const u8 *data, unsigned int n) {
+    if (sess->mode == MODE_CTR)
+        text_iv_add(iv, DIV_ROUND_UP(n, AES_BLOCK_SIZE), true);
+    else if (sess->mode == MODE_XTS)
+        text_iv_add(iv, 1, false);
+    else
+        memcpy(iv, sess->encrypt ? data + n - AES_BLOCK_SIZE : io->next, AES_BLOCK_SIZE);
+}
+
+/*
+ * The kcapi backend for everything that has to be through the cipher when
+ * the call returns: fsync(), PROCESS_RANGE and PROCESS_USER. Async drivers
+ * are waited for. Streamed writes go through text_kcapi_queue() instead;
+ * all callers here run with nothing of the stream in flight, so they can
+ * borrow the session's request.
+ */
+static int text_kcapi_crypt(const struct text_session *sess, u8 *iv, u8 *data, unsigned int len) {
+    unsigned int step = text_kcapi_step(sess);
+    struct text_kcapi_io io;
+    DECLARE_CRYPTO_WAIT(wait);
+    int ret = 0;
+
+    skcipher_request_set_callback(sess->req, CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
+                                  crypto_req_done, &wait);
+
+    while (len) {
+        unsigned int n = min_t(unsigned int, len, step);
+
+        ret = crypto_wait_req(text_kcapi_start(sess, &io, iv, data, n), &wait);
+        if (ret < 0)
+            break;
+        text_kcapi_advance(sess, &io, iv, data, n);
+        data += n;
+        len -= n;
+    }
+
+    memzero_explicit(&io, sizeof(io));
+    return ret;
+}
+
+// Every mode but GCM, starting from @iv and advancing it as one call would
+static int text_cipher_iv(const struct text_session *sess, u8 *iv, u8 *data, unsigned int len) {
+    const struct text_key *key = sess->key;
+
+    if (sess->tfm)
+        return text_kcapi_crypt(sess, iv, data, len);
+
+    switch (sess->mode) {
+    case MODE_CTR:
+        // Same keystream XOR in both directions
+        aes_ctr_crypt(&key->ctx, iv, data, data, len);
+        break;
+    case MODE_XTS:
+        // Sectors are independent, each tweaked by its number in iv
+        if (sess->encrypt)
+            aes_xts_encrypt(&key->xts, iv, data, data, len / xts_sector_size, xts_sector_size);
+        else
+            aes_xts_decrypt(&key->xts, iv, data, data, len / xts_sector_size, xts_sector_size);
+        break;
+    default:
+        if (sess->encrypt)
+            aes_cbc_encrypt(&key->ctx, iv, data, data, len / AES_BLOCK_SIZE);
+        else
+            aes_cbc_decrypt(&key->ctx, iv, data, data, len / AES_BLOCK_SIZE);
+        break;
+    }
+    return 0;
+}
+
+// Modes where any block can be processed without the output of the one before it
+static bool text_parallel(const struct text_session *sess, unsigned int len) {
+    // The crypto API spreads its own work, if its driver can
+    if (sess->tfm)
+        return false;
+    if (!parallel_threshold || len < parallel_threshold || num_online_cpus() < 2)
+        return false;
+    return sess->mode == MODE_CTR || sess->mode == MODE_XTS || (sess->mode == MODE_CBC && !sess->encrypt);
+}
+
+static void text_chunk_work(struct work_struct *work) {
+    struct text_chunk *c = container_of(work, struct text_chunk, work);
+
+    text_cipher_iv(c->sess, c->iv, c->data, c->len);
+}
+
+/*
+ * Cuts the data into one slice per CPU at unit boundaries and gives each
+ * the IV it would have reached sequentially, so the output is the same
+ * byte for byte. The last slice runs here; the call returns only once all
+ * of them are done, so the reader still sees the stream in order.
+ */
+static void text_cipher_parallel(struct text_session *sess, u8 *data, unsigned int len) {
+    unsigned int chunk = DIV_ROUND_UP(len, num_online_cpus());
+    unsigned int nchunks, off, i;
+    struct text_chunk *chunks;
+
+    chunk = max_t(unsigned int, round_up(chunk, text_unit(sess)), PARALLEL_MIN_CHUNK);
+    nchunks = DIV_ROUND_UP(len, chunk);
+    chunks = nchunks > 1 ? kmem_cache_alloc(text_chunks_cache, GFP_KERNEL) : NULL;
+    if (!chunks) {
+        text_cipher_iv(sess, sess->iv, data, len);
+        return;
+    }
+
+    // All IVs are taken before any slice starts: CBC chains on ciphertext that is decrypted in place
+    for (i = 0, off = 0; i < nchunks; i++, off += chunk) {
+        struct text_chunk *c = &chunks[i];
+
+        c->sess = sess;
+        c->data = data + off;
+        c->len = min_t(unsigned int, chunk, len - off);
+        if (sess->mode == MODE_CBC && i) {
+            memcpy(c->iv, data + off - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+            continue;
+        }
+        memcpy(c->iv, sess->iv, AES_BLOCK_SIZE);
+        if (sess->mode == MODE_CTR)
+            text_iv_add(c->iv, off / AES_BLOCK_SIZE, true);
+        else if (sess->mode == MODE_XTS)
+            text_iv_add(c->iv, off / xts_sector_size, false);
+    }
+
+    for (i = 0; i < nchunks - 1; i++) {
+        INIT_WORK(&chunks[i].work, text_chunk_work);
+        queue_work(text_wq, &chunks[i].work);
+    }
+    text_cipher_iv(sess, chunks[i].iv, chunks[i].data, chunks[i].len);
+    for (i = 0; i < nchunks - 1; i++)
+        flush_work(&chunks[i].work);
+
+    // The last slice's IV has advanced to where the whole call would leave it
+    memcpy(sess->iv, chunks[nchunks - 1].iv, AES_BLOCK_SIZE);
+    kmem_cache_free(text_chunks_cache, chunks);
+}
+
+static int text_cipher(struct text_session *sess, u8 *data, unsigned int len) {
+    int ret = 0;
+
+    trace_kaes_cipher_start(sess->id, sess->mode, text_backend_name(sess), len);
+    if (sess->mode == MODE_GCM) {
+        // Keystream and GHASH in one pass over the data
+        if (sess->encrypt)
+            ret = aes_gcm_encrypt(&sess->gcm, &sess->key->ctx, data, data, len);
+        else
+            ret = aes_gcm_decrypt(&sess->gcm, &sess->key->ctx, data, data, len);
+    } else if (text_parallel(sess, len)) {
+        text_cipher_parallel(sess, data, len);
+    } else {
+        ret = text_cipher_iv(sess, sess->iv, data, len);
+    }
+    trace_kaes_cipher_finish(sess->id, ret);
+    return ret;
+}
+
+// Moves out up to done; CBC decryption keeps the last block until fsync() shows whether it is padding
+static void text_publish(struct text_session *sess) {
+    if (sess->mode == MODE_CBC && !sess->encrypt && !sess->finished)
+        sess->out = max_t(size_t, sess->out, sess->done - min_t(size_t, sess->done, AES_BLOCK_SIZE));
+    else
+        sess->out = sess->done;
+}
+
+/*
+ * Runs [done, end) through the cipher, split where the ring wraps. Units
+ * never straddle the wrap: ring_size is a multiple of every unit size and
+ * done only stops short of a unit boundary when the stream ends.
+ */
+static int text_process(struct text_session *sess, size_t end) {
+    u64 start = ktime_get_ns();
+    int ret;
+
+    if (sess->done < end) {
+        do {
+            size_t pos = sess->done & (ring_size - 1);
+            size_t n = min_t(size_t, end - sess->done, ring_size - pos);
+
+            ret = text_cipher(sess, sess->ring + pos, n);
+            if (ret < 0)
+                return ret;
+            sess->done += n;
+        } while (sess->done < end);
+        text_stat_time(STAGE_CIPHER, start);
+    }
+
+    text_publish(sess);
+    return 0;
+}
+
+// The completion callback of queued stream requests, possibly in softirq context
+static void text_kcapi_done(struct crypto_async_request *areq, int err) {
+    struct text_session *sess = areq->data;
+
+    // A backlogged request reports reaching the driver's queue first
+    if (err == -EINPROGRESS)
+        return;
+    sess->req_err = err;
+    queue_work(text_wq, &sess->kcapi_work);
+}
+
+// Accounts for the request in flight the way text_process() does for a synchronous call
+static int text_kcapi_complete(struct text_session *sess, int err) {
+    unsigned int n = sess->req_len;
+
+    trace_kaes_cipher_finish(sess->id, err);
+    WRITE_ONCE(sess->req_len, 0);
+    if (err < 0)
+        return err;
+
+    text_kcapi_advance(sess, &sess->io, sess->iv, sess->ring + (sess->done & (ring_size - 1)), n);
+    text_stat_time(STAGE_CIPHER, sess->req_start);
+    sess->done += n;
+    text_publish(sess);
+    return 0;
+}
+
+/*
+ * Sends [done, req_end) to the driver a request at a time, split where the
+ * ring wraps like text_process(). A request that completes synchronously is
+ * accounted here; one the driver queues (-EINPROGRESS, or -EBUSY once
+ * backlogged) ends the call, and its callback carries on from kcapi_work.
+ * A failure ends the stream.
+ */
+static int text_kcapi_pump(struct text_session *sess) {
+    int ret;
+
+    skcipher_request_set_callback(sess->req, CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
+                                  text_kcapi_done, sess);
+
+    while (!sess->req_len && sess->done < sess->req_end) {
+        size_t pos = sess->done & (ring_size - 1);
+        unsigned int n = min3(sess->req_end - sess->done, (size_t)ring_size - pos, (size_t)text_kcapi_step(sess));
+
+        trace_kaes_cipher_start(sess->id, sess->mode, text_backend_name(sess), n);
+        sess->req_start = ktime_get_ns();
+        WRITE_ONCE(sess->req_len, n);
+        ret = text_kcapi_start(sess, &sess->io, sess->iv, sess->ring + pos, n);
+        if (ret == -EINPROGRESS || ret == -EBUSY)
+            return 0;
+
+        ret = text_kcapi_complete(sess, ret);
+        if (ret < 0) {
+            sess->error = ret;
+            return ret;
+        }
+    }
+    return 0;
+}
+
+// The write side of a kcapi stream: data up to @end is handed over, not waited for
+static int text_kcapi_queue(struct text_session *sess, size_t end) {
+    sess->req_end = end;
+    return text_kcapi_pump(sess);
+}
+
+// Runs from the completion callback; moves the stream on and wakes the read side
+static void text_kcapi_work(struct work_struct *work) {
+    struct text_session *sess = container_of(work, struct text_session, kcapi_work);
+    int ret;
+
+    mutex_lock(&sess->lock);
+    ret = text_kcapi_complete(sess, sess->req_err);
+    if (ret < 0)
+        sess->error = ret;
+    else
+        text_kcapi_pump(sess);
+    mutex_unlock(&sess->lock);
+    // wake_up(), not the interruptible kind: release() waits for req_len uninterruptibly
+    wake_up(&sess->wait);
+}
+
+static ssize_t text_write_raw(struct text_session *sess, struct iov_iter *from) {
+    size_t count = min_t(size_t, iov_iter_count(from), text_space(sess));
+    size_t copied = 0;
+    ssize_t ret = 0;
+
+    while (copied < count) {
+        size_t pos = sess->head & (ring_size - 1);
+        size_t n = min_t(size_t, count - copied, ring_size - pos);
+        size_t c = copy_from_iter(sess->ring + pos, n, from);
+
+        sess->head += c;
+        copied += c;
+        if (c < n) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+    return copied ? copied : ret;
+}
+
+/*
+ * Takes ciphertext as hex or base64 and queues the bytes it decodes to, a
+ * stack chunk at a time. The characters of an incomplete group wait in
+ * armor_in for the next write or fsync(). A chunk that does not decode is
+ * not taken, and base64 padding ends the input.
+ */
+static ssize_t text_write_armor(struct text_session *sess, struct iov_iter *from) {
+    unsigned int raw = text_armor_raw(sess->armor), chars = text_armor_chars(sess->armor);
+    char text[ARMOR_CHUNK / 3 * 4];
+    u8 data[ARMOR_CHUNK];
+    size_t copied = 0, room, want, len, whole, c;
+    ssize_t ret = 0;
+    int n;
+
+    while (iov_iter_count(from)) {
+        if (sess->armor_ended) {
+            ret = -EINVAL;
+            break;
+        }
+
+        // Whole groups that fit the queue, and the start of one more
+        room = text_space(sess) / raw * chars + chars - 1;
+        want = min3(iov_iter_count(from), sizeof(text) - sess->armor_in_len, room - sess->armor_in_len);
+        if (!want)
+            break;
+
+        memcpy(text, sess->armor_in, sess->armor_in_len);
+        c = copy_from_iter(text + sess->armor_in_len, want, from);
+        len = sess->armor_in_len + c;
+        whole = round_down(len, chars);
+
+        if (sess->armor == VENCRYPT_ARMOR_HEX)
+            n = armor_hex_decode(data, text, whole);
+        else
+            n = armor_base64_decode(data, text, whole);
+        if (n < 0) {
+            ret = n;
+            break;
+        }
+        if (whole && text[whole - 1] == '=') {
+            if (len > whole) {
+                ret = -EINVAL;
+                break;
+            }
+            sess->armor_ended = true;
+        }
+
+        text_ring_put(sess, data, n);
+        sess->armor_in_len = len - whole;
+        memcpy(sess->armor_in, text + whole, sess->armor_in_len);
+        copied += c;
+        if (c < want) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+    return copied ? copied : ret;
+}
 
-struct text_device {
-    struct cdev cdev;
-    dev_t dev_number;
-    struct class *dev_class;
-    struct device *device;
-    char buffer[BUFFER_SIZE];
-    int key;
-    int status;
-};
+// Decodes the characters left in armor_in as the last group of the input
+static int text_armor_flush(struct text_session *sess) {
+    u8 data[3];
+    int n;
 
-static struct text_device *my_device;
+    if (!sess->armor_in_len)
+        return 0;
 
-static int text_open(struct inode *inode, struct file *file) {
-    struct text_device *dev = container_of(inode->i_cdev, struct text_device, cdev);
-    file->private_data = dev; 
-    printk(KERN_INFO "%s device opened!\n", DEVICE_NAME_CT); 
+    // Hex has no partial groups, base64 may leave its padding off
+    if (sess->armor == VENCRYPT_ARMOR_HEX)
+        n = armor_hex_decode(data, sess->armor_in, sess->armor_in_len);
+    else
+        n = armor_base64_decode(data, sess->armor_in, sess->armor_in_len);
+    if (n < 0)
+        return n;
+    if (text_space(sess) < n)
+        return -ENOSPC;
+
+    text_ring_put(sess, data, n);
+    sess->armor_in_len = 0;
+    return text_process(sess, round_down(sess->head, text_unit(sess)));
+}
+
+static ssize_t text_write_locked(struct text_session *sess, struct file *file, struct iov_iter *from) {
+    size_t end;
+    u64 start;
+    ssize_t ret;
+    int err;
+
+    if (!text_key_ready(sess))
+        return -ENOKEY;
+
+    if (sess->finished || (sess->mode == MODE_GCM && !sess->gcm_ready))
+        return -EINVAL;
+
+    if (sess->error)
+        return sess->error;
+
+    if (!iov_iter_count(from))
+        return 0;
+
+    // Block while the queue is full; the reader frees room as it drains
+    err = text_wait(sess, file, text_writable);
+    if (err < 0)
+        return err;
+    if (sess->error)
+        return sess->error;
+    if (sess->finished)
+        return -EINVAL;
+    if (text_stalled(sess))
+        return -EMSGSIZE;
+
+    start = ktime_get_ns();
+    if (text_armor_in(sess))
+        ret = text_write_armor(sess, from);
+    else
+        ret = text_write_raw(sess, from);
+    text_stat_time(STAGE_COPY_IN, start);
+
+    // Cipher every block (XTS: sector) completed so far, a partial one waits for the next write
+    end = round_down(sess->head, text_unit(sess));
+    err = sess->req ? text_kcapi_queue(sess, end) : text_process(sess, end);
+    if (err < 0)
+        return err;
+
+    return ret;
+}
+
+/*
+ * Ends a GCM stream: the partial last block, if any, goes through the cipher
+ * and GHASH now, then the tag is computed.
+ */
+static int text_gcm_final(struct text_session *sess, u8 *tag) {
+    int ret;
+
+    if (sess->mode != MODE_GCM || !sess->gcm_ready || sess->finished)
+        return -EINVAL;
+
+    ret = text_armor_flush(sess);
+    if (ret < 0)
+        return ret;
+
+    ret = text_process(sess, sess->head);
+    if (ret < 0)
+        return ret;
+
+    aes_gcm_final(&sess->gcm, &sess->key->ctx, tag);
+    sess->finished = true;
     return 0;
 }
 
-static int text_release(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "%s device closed!\n", DEVICE_NAME_CT);
+// Strips and checks PKCS#7 padding from the held-back last plaintext block
+static int text_unpad(struct text_session *sess) {
+    u8 last[AES_BLOCK_SIZE];
+    unsigned int pad, i, bad = 0;
+
+    if (sess->head != sess->done || sess->done < AES_BLOCK_SIZE)
+        return -EINVAL;
+
+    memcpy(last, sess->ring + ((sess->done - AES_BLOCK_SIZE) & (ring_size - 1)), AES_BLOCK_SIZE);
+    pad = last[AES_BLOCK_SIZE - 1];
+    if (!pad || pad > AES_BLOCK_SIZE)
+        return -EBADMSG;
+    for (i = AES_BLOCK_SIZE - pad; i < AES_BLOCK_SIZE; i++)
+        bad |= last[i] ^ pad;
+    if (bad)
+        return -EBADMSG;
+
+    sess->out = sess->done - pad;
     return 0;
 }
 
-static ssize_t text_read(struct file *file, char __user *buf, size_t count, loff_t *offset) {
-    struct text_device *dev = file->private_data;
+/*
+ * Ends a stream on fsync(): CBC encryption appends PKCS#7 padding (always
+ * 1 to 16 bytes, so the length can be recovered) and decryption strips it;
+ * CTR ciphers its partial last block. GCM ends with its tag ioctls instead.
+ */
+static int text_finish(struct text_session *sess) {
+    size_t left;
+    unsigned int pad, i;
+    int ret;
 
-    if (*offset >= BUFFER_SIZE)
-        return 0; 
+    if (sess->finished)
+        return 0;
+    if (sess->error)
+        return sess->error;
 
-    if (*offset + count > BUFFER_SIZE)
-        count = BUFFER_SIZE - *offset;
+    ret = text_armor_flush(sess);
+    if (ret < 0)
+        return ret;
+    left = sess->head - sess->done;
 
-    if (copy_to_user(buf, dev->buffer + *offset, count))
+    switch (sess->mode) {
+    case MODE_CTR:
+        ret = text_process(sess, sess->head);
+        break;
+    case MODE_GCM:
+        return -EINVAL;
+    case MODE_XTS:
+        // No ciphertext stealing; the stream has to be whole sectors
+        ret = left ? -EINVAL : 0;
+        break;
+    default:
+        if (!sess->encrypt) {
+            ret = text_unpad(sess);
+            break;
+        }
+        pad = AES_BLOCK_SIZE - left;
+        if (text_space(sess) < pad)
+            return -ENOSPC;
+        for (i = 0; i < pad; i++)
+            sess->ring[(sess->head + i) & (ring_size - 1)] = pad;
+        sess->head += pad;
+        ret = text_process(sess, sess->head);
+        break;
+    }
+
+    if (ret < 0)
+        return ret;
+    sess->finished = true;
+    return 0;
+}
+
+static int text_fsync(struct file *file, loff_t start, loff_t end, int datasync) {
+    struct text_session *sess = file->private_data;
+    int ret;
+
+    mutex_lock(&sess->lock);
+    ret = text_wait(sess, file, text_finishable);
+    if (!ret)
+        ret = text_finish(sess);
+    mutex_unlock(&sess->lock);
+    // The end of the stream wakes readers waiting for more
+    wake_up_interruptible(&sess->wait);
+    return ret;
+}
+
+/*
+ * Transforms part of the mmap()ed ring in place, carrying on the stream's
+ * IV, counter or GCM state. Userspace owns the ring for this, so it must
+ * not hold streamed data at the same time. Padding is up to the caller.
+ */
+static int text_process_range(struct text_session *sess, const struct vencrypt_range *vr) {
+    u64 off = vr->offset, left = vr->len, start;
+    int ret;
+
+    if (!text_key_ready(sess))
+        return -ENOKEY;
+
+    if (sess->finished || (sess->mode == MODE_GCM && !sess->gcm_ready))
+        return -EINVAL;
+
+    if (sess->head != sess->tail)
+        return -EBUSY;
+
+    if (off > ring_size || left > ring_size - off)
+        return -EINVAL;
+
+    // Only CTR and GCM can end on a partial block
+    if (left % text_unit(sess) && sess->mode != MODE_CTR && sess->mode != MODE_GCM)
+        return -EINVAL;
+
+    start = ktime_get_ns();
+    while (left) {
+        unsigned int n = min_t(u64, left, RANGE_CHUNK);
+
+        // Parallel work is spread out, so each CPU still gets RANGE_CHUNK between reschedules
+        if (text_parallel(sess, n))
+            n = min_t(u64, left, (u64)RANGE_CHUNK * num_online_cpus());
+
+        ret = text_cipher(sess, sess->ring + off, n);
+        if (ret < 0)
+            return ret;
+        off += n;
+        left -= n;
+        cond_resched();
+    }
+    text_stat_time(STAGE_CIPHER, start);
+    return 0;
+}
+
+/*
+ * PROCESS_RANGE over the caller's memory instead of the ring, with no copy
+ * and no buffer that grows with the request: the pages are pinned and
+ * mapped USER_PIN_PAGES at a time and ciphered where they are. A window
+ * stops at a unit boundary; the next one starts on the page holding the
+ * rest, so units may straddle pages and windows.
+ */
+static int text_process_user(struct text_session *sess, const struct vencrypt_span *vs) {
+    struct page *pages[USER_PIN_PAGES];
+    unsigned long addr = vs->ptr;
+    u64 left = vs->len, start;
+    unsigned int off, n;
+    int nr, ret = 0;
+    void *map;
+
+    if (!text_key_ready(sess))
+        return -ENOKEY;
+
+    if (sess->finished || (sess->mode == MODE_GCM && !sess->gcm_ready))
+        return -EINVAL;
+
+    // Same rule as PROCESS_RANGE: the stream state must not be halfway through streamed data
+    if (sess->head != sess->tail)
+        return -EBUSY;
+
+    if (left % text_unit(sess) && sess->mode != MODE_CTR && sess->mode != MODE_GCM)
+        return -EINVAL;
+
+    if (!access_ok(u64_to_user_ptr(vs->ptr), vs->len))
         return -EFAULT;
 
-    *offset += count;
-    return count;
+    start = ktime_get_ns();
+    while (left) {
+        off = offset_in_page(addr);
+        nr = min_t(u64, DIV_ROUND_UP(off + left, PAGE_SIZE), USER_PIN_PAGES);
+        nr = pin_user_pages_fast(addr & PAGE_MASK, nr, FOLL_WRITE, pages);
+        if (nr <= 0) {
+            ret = nr ?: -EFAULT;
+            break;
+        }
+
+        map = vm_map_ram(pages, nr, NUMA_NO_NODE);
+        if (!map) {
+            unpin_user_pages(pages, nr);
+            ret = -ENOMEM;
+            break;
+        }
+
+        // Whole units, unless the window reaches the end; none fitting means the pin came up short
+        n = min_t(u64, left, (u64)nr * PAGE_SIZE - off);
+        if (n < left)
+            n = round_down(n, text_unit(sess));
+        ret = n ? text_cipher(sess, map + off, n) : -EFAULT;
+
+        vm_unmap_ram(map, nr);
+        unpin_user_pages_dirty_lock(pages, nr, true);
+        if (ret < 0)
+            break;
+        addr += n;
+        left -= n;
+        cond_resched();
+    }
+    text_stat_time(STAGE_CIPHER, start);
+    return ret;
+}
+
+/*
+ * Item buffers for batch and async requests. The mempool keeps
+ * bounce_reserve of them back, so with GFP_KERNEL a request waits for one
+ * to be returned under memory pressure instead of failing.
+ */
+static u8 *text_bounce_get(void) {
+    return mempool_alloc(text_bounce_pool, GFP_KERNEL);
 }
 
-static ssize_t text_write(struct file *file, const char __user *buf, size_t count, loff_t *offset) {
-    struct text_device *dev = file->private_data; 
+// Items are plaintext on one side, so the buffer is wiped before it is reused
+static void text_bounce_put(u8 *bounce) {
+    memzero_explicit(bounce, bounce_size);
+    mempool_free(bounce, text_bounce_pool);
+}
+
+/*
+ * One batch item, bounced through @data, a bounce_size buffer. The IV is a
+ * local copy, so items are independent of each other and of the stream.
+ */
+static int text_batch_item(struct text_session *sess, struct vencrypt_item *item, u8 *data) {
+    const struct text_key *key = sess->key;
+    u8 tag[AES_GCM_TAG_SIZE];
+    struct aes_gcm_ctx gcm;
+    u64 start;
+    int ret = 0;
 
-    if (*offset >= BUFFER_SIZE)
-        return -ENOSPC; 
+    if (!text_key_ready(sess))
+        return -ENOKEY;
 
-    if (*offset + count > BUFFER_SIZE)
-        count = BUFFER_SIZE - *offset;
+    if (item->len > bounce_size)
+        return -EMSGSIZE;
 
-    if (copy_from_user(dev->buffer + *offset, buf, count))
+    if ((sess->mode == MODE_CBC || sess->mode == MODE_XTS) && item->len % AES_BLOCK_SIZE)
+        return -EINVAL;
+
+    start = ktime_get_ns();
+    if (copy_from_user(data, u64_to_user_ptr(item->in_ptr), item->len))
         return -EFAULT;
+    text_stat_time(STAGE_COPY_IN, start);
 
-    *offset += count;
-    return count;
+    start = ktime_get_ns();
+    trace_kaes_cipher_start(sess->id, sess->mode, text_backend_name(sess), item->len);
+    switch (sess->mode) {
+    case MODE_CTR:
+        aes_ctr_crypt(&key->ctx, item->iv, data, data, item->len);
+        break;
+    case MODE_GCM:
+        aes_gcm_init(&gcm, &key->ctx, item->iv, AES_GCM_IV_SIZE);
+        if (sess->encrypt)
+            ret = aes_gcm_encrypt(&gcm, &key->ctx, data, data, item->len);
+        else
+            ret = aes_gcm_decrypt(&gcm, &key->ctx, data, data, item->len);
+        if (ret < 0)
+            break;
+        aes_gcm_final(&gcm, &key->ctx, tag);
+        if (sess->encrypt)
+            memcpy(item->tag, tag, sizeof(tag));
+        // Unauthenticated plaintext never reaches userspace
+        else if (crypto_memneq(tag, item->tag, sizeof(tag)))
+            ret = -EBADMSG;
+        break;
+    case MODE_XTS:
+        if (!item->len)
+            break;
+        if (sess->encrypt)
+            aes_xts_encrypt(&key->xts, item->iv, data, data, 1, item->len);
+        else
+            aes_xts_decrypt(&key->xts, item->iv, data, data, 1, item->len);
+        break;
+    default:
+        if (sess->encrypt)
+            aes_cbc_encrypt(&key->ctx, item->iv, data, data, item->len / AES_BLOCK_SIZE);
+        else
+            aes_cbc_decrypt(&key->ctx, item->iv, data, data, item->len / AES_BLOCK_SIZE);
+        break;
+    }
+    trace_kaes_cipher_finish(sess->id, ret);
+    if (ret < 0)
+        return ret;
+    text_stat_time(STAGE_CIPHER, start);
+
+    start = ktime_get_ns();
+    if (copy_to_user(u64_to_user_ptr(item->out_ptr), data, item->len))
+        return -EFAULT;
+    text_stat_time(STAGE_COPY_OUT, start);
+    return 0;
+}
+
+/*
+ * Runs a whole array of messages in one syscall. A failed item only sets
+ * its own status; the call itself fails only if the array can't be read.
+ */
+static int text_batch(struct text_session *sess, const struct vencrypt_batch *vb) {
+    struct vencrypt_item __user *uitems = u64_to_user_ptr(vb->items);
+    struct vencrypt_item item;
+    u8 *bounce;
+    int ret = 0;
+    u32 i;
+
+    if (vb->reserved || vb->count > VENCRYPT_BATCH_MAX)
+        return -EINVAL;
+
+    if (!text_key_ready(sess))
+        return -ENOKEY;
+
+    // Its own buffer, so a batch can run while the stream holds data
+    bounce = text_bounce_get();
+
+    for (i = 0; i < vb->count; i++) {
+        if (copy_from_user(&item, &uitems[i], sizeof(item))) {
+            ret = -EFAULT;
+            break;
+        }
+        item.status = text_batch_item(sess, &item, bounce);
+        text_stat_op(sess->mode, item.status, item.status ? 0 : item.len, item.status ? 0 : item.len);
+        if (copy_to_user(&uitems[i].status, &item.status, sizeof(item.status)) ||
+            copy_to_user(uitems[i].tag, item.tag, sizeof(item.tag))) {
+            ret = -EFAULT;
+            break;
+        }
+        cond_resched();
+    }
+
+    text_bounce_put(bounce);
+    return ret;
+}
+
+/*
+ * Drains the submission ring. Stops early when the completion ring is full;
+ * the next kick picks up from there. The session lock is taken per request
+ * so foreground calls on the same file are never held off for long.
+ */
+static void text_async_work(struct work_struct *work) {
+    struct text_async *as = container_of(work, struct text_async, work);
+    struct vencrypt_async_ring *r = as->ring;
+    u32 sq_head = as->sq_head, cq_tail = as->cq_tail, n = 0;
+    struct vencrypt_sqe sqe;
+    struct vencrypt_cqe *cqe;
+
+    u8 *bounce;
+
+    if (!mmget_not_zero(as->mm))
+        return;
+    kthread_use_mm(as->mm);
+    bounce = text_bounce_get();
+
+    while (sq_head != smp_load_acquire(&r->sq_tail)) {
+        if (cq_tail - smp_load_acquire(&r->cq_head) >= as->cq_entries)
+            break;
+
+        // Snapshot the SQE, userspace can rewrite it under us
+        memcpy(&sqe, &as->sqes[sq_head & (as->sq_entries - 1)], sizeof(sqe));
+        smp_store_release(&r->sq_head, ++sq_head);
+
+        cqe = &as->cqes[cq_tail & (as->cq_entries - 1)];
+        mutex_lock(&as->sess->lock);
+        cqe->status = text_batch_item(as->sess, &sqe.item, bounce);
+        text_stat_op(as->sess->mode, cqe->status, cqe->status ? 0 : sqe.item.len, cqe->status ? 0 : sqe.item.len);
+        mutex_unlock(&as->sess->lock);
+        cqe->user_data = sqe.user_data;
+        memcpy(cqe->tag, sqe.item.tag, sizeof(cqe->tag));
+        smp_store_release(&r->cq_tail, ++cq_tail);
+
+        // Let a waiting consumer start on the first completions early
+        if (++n % 32 == 0) {
+            if (as->eventfd)
+                eventfd_signal(as->eventfd, 1);
+            cond_resched();
+        }
+    }
+
+    text_bounce_put(bounce);
+    kthread_unuse_mm(as->mm);
+    mmput(as->mm);
+    as->sq_head = sq_head;
+    as->cq_tail = cq_tail;
+
+    if (n % 32 && as->eventfd)
+        eventfd_signal(as->eventfd, 1);
+}
+
+static int text_async_setup(struct text_session *sess, struct vencrypt_async_setup *setup) {
+    struct text_async *as;
+    int ret;
+
+    if (sess->async)
+        return -EBUSY;
+
+    if (setup->reserved || !is_power_of_2(setup->sq_entries) || !is_power_of_2(setup->cq_entries) ||
+        setup->sq_entries > VENCRYPT_ASYNC_MAX || setup->cq_entries > 2 * VENCRYPT_ASYNC_MAX ||
+        setup->cq_entries < setup->sq_entries)
+        return -EINVAL;
+
+    as = kzalloc(sizeof(*as), GFP_KERNEL);
+    if (!as)
+        return -ENOMEM;
+
+    as->sq_entries = setup->sq_entries;
+    as->cq_entries = setup->cq_entries;
+    setup->sq_off = L1_CACHE_ALIGN(sizeof(struct vencrypt_async_ring));
+    setup->cq_off = L1_CACHE_ALIGN(setup->sq_off + as->sq_entries * sizeof(struct vencrypt_sqe));
+    setup->size = PAGE_ALIGN(setup->cq_off + as->cq_entries * sizeof(struct vencrypt_cqe));
+    as->size = setup->size;
+
+    ret = -ENOMEM;
+    as->area = vmalloc_user(as->size);
+    if (!as->area)
+        goto fail;
+    as->ring = as->area;
+    as->sqes = as->area + setup->sq_off;
+    as->cqes = as->area + setup->cq_off;
+
+    if (setup->eventfd >= 0) {
+        as->eventfd = eventfd_ctx_fdget(setup->eventfd);
+        if (IS_ERR(as->eventfd)) {
+            ret = PTR_ERR(as->eventfd);
+            as->eventfd = NULL;
+            goto fail;
+        }
+    }
+
+    as->sess = sess;
+    as->mm = current->mm;
+    mmgrab(as->mm);
+    INIT_WORK(&as->work, text_async_work);
+    sess->async = as;
+    return 0;
+
+fail:
+    vfree(as->area);
+    kfree(as);
+    return ret;
+}
+
+// A 128, 192 or 256-bit key, or an XTS key pair, into a fresh @key
+static int text_expand_key(struct text_key *key, const u8 *raw, unsigned int key_len) {
+    int ret;
+
+    if (key_len != 16 && key_len != 24 && key_len != 32 && key_len != 48 && key_len != 64)
+        return -EINVAL;
+
+    memcpy(key->key, raw, key_len);
+
+    // Expand the schedules here, once, instead of per block
+    if (key_len > AES_MAX_KEY_SIZE) {
+        ret = aes_xts_set_key(&key->xts, key->key, key_len);
+        if (ret < 0)
+            return ret;
+        key->xts_ready = true;
+    } else {
+        ret = aes_set_key(&key->ctx, key->key, key_len);
+        if (ret < 0)
+            return ret;
+        key->xts_ready = !aes_xts_set_key(&key->xts, key->key, key_len);
+    }
+
+    key->key_len = key_len;
+    return 0;
+}
+
+// A new key from a hex string, the format of SET_KEY and the sysfs file
+static struct text_key *text_parse_key(const char *hex, size_t len) {
+    u8 raw[2 * AES_MAX_KEY_SIZE];
+    struct text_key *key;
+    int ret;
+
+    if ((len & 1) || len / 2 > sizeof(raw) || hex2bin(raw, hex, len / 2))
+        return ERR_PTR(-EINVAL);
+
+    key = text_key_alloc();
+    if (!key) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = text_expand_key(key, raw, len / 2);
+    if (ret < 0)
+        text_key_put(key);
+out:
+    memzero_explicit(raw, sizeof(raw));
+    return ret < 0 ? ERR_PTR(ret) : key;
+}
+
+// Loads a raw key into the table and returns its handle
+static int text_key_load(struct vencrypt_key *vk) {
+    struct text_key *key;
+    int ret;
+
+    if (vk->key_len > sizeof(vk->key))
+        return -EINVAL;
+
+    key = text_key_alloc();
+    if (!key)
+        return -ENOMEM;
+
+    ret = text_expand_key(key, vk->key, vk->key_len);
+    if (ret < 0) {
+        text_key_put(key);
+        return ret;
+    }
+    return text_key_insert(key, &vk->handle);
+}
+
+static int text_set_iv(struct text_session *sess, const struct vencrypt_buf *vb) {
+    u8 iv[AES_BLOCK_SIZE];
+
+    if (vb->reserved || sess->head)
+        return -EINVAL;
+
+    if (sess->mode == MODE_GCM) {
+        if (!text_key_ready(sess))
+            return -ENOKEY;
+        if (vb->len != AES_GCM_IV_SIZE)
+            return -EINVAL;
+        if (copy_from_user(iv, u64_to_user_ptr(vb->ptr), AES_GCM_IV_SIZE))
+            return -EFAULT;
+        aes_gcm_init(&sess->gcm, &sess->key->ctx, iv, AES_GCM_IV_SIZE);
+        sess->gcm_ready = true;
+        return 0;
+    }
+
+    if (vb->len != AES_BLOCK_SIZE)
+        return -EINVAL;
+    if (copy_from_user(sess->iv, u64_to_user_ptr(vb->ptr), AES_BLOCK_SIZE))
+        return -EFAULT;
+    return 0;
+}
+
+static int text_set_aad(struct text_session *sess, const struct vencrypt_buf *vb) {
+    const u8 __user *src = u64_to_user_ptr(vb->ptr);
+    u8 chunk[256];
+    u32 left = vb->len;
+    int ret;
+
+    if (vb->reserved || sess->mode != MODE_GCM || !sess->gcm_ready || sess->head || sess->gcm.aad_len)
+        return -EINVAL;
+
+    // Whole-block chunks, so only the last one can carry a partial block
+    while (left) {
+        u32 n = min_t(u32, left, sizeof(chunk));
+
+        if (copy_from_user(chunk, src, n))
+            return -EFAULT;
+        ret = aes_gcm_aad(&sess->gcm, &sess->key->ctx, chunk, n);
+        if (ret < 0)
+            return ret;
+        src += n;
+        left -= n;
+    }
+    return 0;
+}
+
+static long text_ioctl_locked(struct text_session *sess, unsigned int cmd, unsigned long arg) {
+    void __user *argp = (void __user *)arg;
+    char hex[2 * AES_MAX_KEY_SIZE + 1];
+    struct vencrypt_buf vb;
+    struct vencrypt_range vr;
+    struct vencrypt_span vs;
+    struct vencrypt_batch vbat;
+    struct vencrypt_async_setup vas;
+    struct vencrypt_tag vt;
+    struct vencrypt_key vk;
+    struct text_key *key;
+    u8 tag[AES_GCM_TAG_SIZE];
+    u32 handle;
+    long len;
+    int ret;
+
+    switch (cmd) {
+    case VENCRYPT_IOCTL_SET_KEY:
+        len = strncpy_from_user(hex, argp, sizeof(hex));
+        if (len < 0)
+            return len;
+        if (len == sizeof(hex))
+            return -EINVAL;
+        key = text_parse_key(hex, len);
+        memzero_explicit(hex, sizeof(hex));
+        if (IS_ERR(key))
+            return PTR_ERR(key);
+        return text_use_key(sess, key);
+
+    case VENCRYPT_IOCTL_SET_ENCRYPT:
+        // The direction cannot flip halfway through a stream
+        if (sess->head || sess->armor_in_len)
+            return -EINVAL;
+        sess->encrypt = !!arg;
+        return 0;
+
+    case VENCRYPT_IOCTL_SET_ARMOR:
+        if (arg >= ARRAY_SIZE(armor_names) || sess->head || sess->armor_in_len)
+            return -EINVAL;
+        sess->armor = arg;
+        return 0;
+
+    case VENCRYPT_IOCTL_SET_IV:
+    case VENCRYPT_IOCTL_SET_AAD:
+        if (copy_from_user(&vb, argp, sizeof(vb)))
+            return -EFAULT;
+        if (cmd == VENCRYPT_IOCTL_SET_IV)
+            return text_set_iv(sess, &vb);
+        return text_set_aad(sess, &vb);
+
+    case VENCRYPT_IOCTL_GET_TAG:
+        if (!sess->encrypt)
+            return -EINVAL;
+        ret = text_gcm_final(sess, vt.tag);
+        if (ret < 0)
+            return ret;
+        if (copy_to_user(argp, &vt, sizeof(vt)))
+            return -EFAULT;
+        return 0;
+
+    case VENCRYPT_IOCTL_CHECK_TAG:
+        if (sess->encrypt)
+            return -EINVAL;
+        if (copy_from_user(&vt, argp, sizeof(vt)))
+            return -EFAULT;
+        ret = text_gcm_final(sess, tag);
+        if (ret < 0)
+            return ret;
+        if (crypto_memneq(tag, vt.tag, sizeof(tag)))
+            return -EBADMSG;
+        sess->verified = true;
+        return 0;
+
+    case VENCRYPT_IOCTL_PROCESS_RANGE:
+        if (copy_from_user(&vr, argp, sizeof(vr)))
+            return -EFAULT;
+        // Counted as bytes in and out, though they never leave the mapping
+        ret = text_process_range(sess, &vr);
+        text_stat_op(sess->mode, ret, ret ? 0 : vr.len, ret ? 0 : vr.len);
+        return ret;
+
+    case VENCRYPT_IOCTL_PROCESS_USER:
+        if (copy_from_user(&vs, argp, sizeof(vs)))
+            return -EFAULT;
+        ret = text_process_user(sess, &vs);
+        text_stat_op(sess->mode, ret, ret ? 0 : vs.len, ret ? 0 : vs.len);
+        return ret;
+
+    case VENCRYPT_IOCTL_BATCH:
+        if (copy_from_user(&vbat, argp, sizeof(vbat)))
+            return -EFAULT;
+        return text_batch(sess, &vbat);
+
+    case VENCRYPT_IOCTL_ASYNC_SETUP:
+        if (copy_from_user(&vas, argp, sizeof(vas)))
+            return -EFAULT;
+        ret = text_async_setup(sess, &vas);
+        if (ret < 0)
+            return ret;
+        if (copy_to_user(argp, &vas, sizeof(vas)))
+            return -EFAULT;
+        return 0;
+
+    case VENCRYPT_IOCTL_ASYNC_KICK:
+        if (!sess->async)
+            return -EINVAL;
+        queue_work(text_wq, &sess->async->work);
+        return 0;
+
+    case VENCRYPT_IOCTL_KEY_LOAD:
+        if (copy_from_user(&vk, argp, sizeof(vk)))
+            return -EFAULT;
+        ret = text_key_load(&vk);
+        memzero_explicit(vk.key, sizeof(vk.key));
+        if (ret < 0)
+            return ret;
+        if (put_user(vk.handle, &((struct vencrypt_key __user *)argp)->handle))
+            return -EFAULT;
+        return 0;
+
+    case VENCRYPT_IOCTL_KEY_USE:
+        if (get_user(handle, (u32 __user *)argp))
+            return -EFAULT;
+        key = text_key_get(handle);
+        if (!key)
+            return -ENOENT;
+        return text_use_key(sess, key);
+
+    case VENCRYPT_IOCTL_KEY_DROP:
+        if (get_user(handle, (u32 __user *)argp))
+            return -EFAULT;
+        return text_key_drop(handle);
+
+    default:
+        return -ENOTTY;
+    }
+}
+
+/*
+ * read()/write() and their vector forms. splice() and sendfile() come in
+ * here too through the generic pipe helpers, so pipe pages are copied
+ * straight into or out of the ring with no userspace buffer in between.
+ */
+static ssize_t text_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct text_session *sess = iocb->ki_filp->private_data;
+    ssize_t ret;
+
+    mutex_lock(&sess->lock);
+    ret = text_read_locked(sess, iocb->ki_filp, to);
+    text_stat_op(sess->mode, ret, 0, ret > 0 ? ret : 0);
+    mutex_unlock(&sess->lock);
+    trace_kaes_read_done(sess->id, ret);
+    if (ret > 0)
+        wake_up_interruptible(&sess->wait);
+    return ret;
+}
+
+static ssize_t text_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct text_session *sess = iocb->ki_filp->private_data;
+    ssize_t ret;
+
+    mutex_lock(&sess->lock);
+    trace_kaes_write_enter(sess->id, sess->mode, text_backend_name(sess), iov_iter_count(from));
+    ret = text_write_locked(sess, iocb->ki_filp, from);
+    text_stat_op(sess->mode, ret, ret > 0 ? ret : 0, 0);
+    mutex_unlock(&sess->lock);
+    trace_kaes_write_exit(sess->id, ret);
+    if (ret > 0)
+        wake_up_interruptible(&sess->wait);
+    return ret;
+}
+
+static long text_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct text_session *sess = file->private_data;
+    long ret;
+
+    mutex_lock(&sess->lock);
+    ret = text_ioctl_locked(sess, cmd, arg);
+    mutex_unlock(&sess->lock);
+    // GET_TAG and CHECK_TAG end GCM streams
+    wake_up_interruptible(&sess->wait);
+    return ret;
+}
+
+static __poll_t text_poll(struct file *file, poll_table *wait) {
+    struct text_session *sess = file->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(file, &sess->wait, wait);
+    mutex_lock(&sess->lock);
+    if (text_readable(sess))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (text_stalled(sess) || sess->error)
+        mask |= EPOLLERR;
+    else if (text_writable(sess))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    mutex_unlock(&sess->lock);
+    return mask;
+}
+
+// The session ring, for PROCESS_RANGE; the mapping pins the file, so release() comes after munmap()
+static int text_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct text_session *sess = file->private_data;
+
+    if (vma->vm_pgoff == VENCRYPT_MMAP_ASYNC >> PAGE_SHIFT) {
+        if (!sess->async)
+            return -EINVAL;
+        return remap_vmalloc_range(vma, sess->async->area, 0);
+    }
+
+    return remap_vmalloc_range(vma, sess->ring, vma->vm_pgoff);
 }
 
 static ssize_t key_show(struct device *dev, struct device_attribute *attr, char *buf) {
     struct text_device *tdev = dev_get_drvdata(dev);
-    return sprintf(buf, "%d\n", tdev->key); 
+    unsigned int bits;
+
+    // Never echo key material, only its size in bits
+    mutex_lock(&tdev->lock);
+    bits = tdev->key->key_len * 8;
+    mutex_unlock(&tdev->lock);
+    return sprintf(buf, "%u\n", bits); 
 }
 
 static ssize_t key_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
     struct text_device *tdev = dev_get_drvdata(dev);
-    sscanf(buf, "%d", &tdev->key);
+    struct text_key *key, *old;
+    size_t len = count;
+
+    if (len && buf[len - 1] == '\n')
+        len--;
+
+    key = text_parse_key(buf, len);
+    if (IS_ERR(key))
+        return PTR_ERR(key);
+
+    // Sessions already open keep their reference to the old key
+    mutex_lock(&tdev->lock);
+    old = tdev->key;
+    tdev->key = key;
+    mutex_unlock(&tdev->lock);
+    text_key_put(old);
+
     return count;
 }
 
@@ -88,29 +2125,210 @@ static ssize_t status_store(struct device *dev, struct device_attribute *attr, c
     return count;
 }
 
+static ssize_t mode_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct text_device *tdev = dev_get_drvdata(dev);
+    return sprintf(buf, "%s\n", mode_names[tdev->mode]); 
+}
+
+static ssize_t mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct text_device *tdev = dev_get_drvdata(dev);
+    int mode = sysfs_match_string(mode_names, buf);
+
+    if (mode < 0)
+        return mode;
+
+    // Takes effect for sessions opened from now on
+    mutex_lock(&tdev->lock);
+    tdev->mode = mode;
+    mutex_unlock(&tdev->lock);
+    return count;
+}
+
+static ssize_t armor_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct text_device *tdev = dev_get_drvdata(dev);
+    return sprintf(buf, "%s\n", armor_names[tdev->armor]);
+}
+
+static ssize_t armor_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct text_device *tdev = dev_get_drvdata(dev);
+    int armor = sysfs_match_string(armor_names, buf);
+
+    if (armor < 0)
+        return armor;
+
+    // Like mode, for sessions opened from now on
+    mutex_lock(&tdev->lock);
+    tdev->armor = armor;
+    mutex_unlock(&tdev->lock);
+    return count;
+}
+
+// One line per mode: bytes in, bytes out, requests and failed requests, summed over CPUs
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    ssize_t len = 0;
+    unsigned int m;
+    int cpu;
+
+    for (m = 0; m < ARRAY_SIZE(mode_names); m++) {
+        u64 in = 0, out = 0, ops = 0, errors = 0;
+
+        for_each_possible_cpu(cpu) {
+            const struct text_stats *st = per_cpu_ptr(&text_stats, cpu);
+
+            in += READ_ONCE(st->bytes_in[m]);
+            out += READ_ONCE(st->bytes_out[m]);
+            ops += READ_ONCE(st->ops[m]);
+            errors += READ_ONCE(st->errors[m]);
+        }
+        len += sysfs_emit_at(buf, len, "%s %llu %llu %llu %llu\n", mode_names[m], in, out, ops, errors);
+    }
+    return len;
+}
+
 static DEVICE_ATTR_RW(key);  // dev_attr_key
 static DEVICE_ATTR_RW(status); // dev_attr_status
+static DEVICE_ATTR_RW(mode); // dev_attr_mode
+static DEVICE_ATTR_RW(armor); // dev_attr_armor
+static DEVICE_ATTR_RO(stats); // dev_attr_stats
+
+/*
+ * debugfs kaes/latency: per stage, "<stage> <ns> <count>" for each non-empty
+ * bucket, where <ns> is the bucket's lower bound.
+ */
+static int text_latency_show(struct seq_file *m, void *v) {
+    unsigned int stage, b;
+    int cpu;
+
+    for (stage = 0; stage < NR_STAGES; stage++) {
+        for (b = 0; b < STATS_BUCKETS; b++) {
+            u64 count = 0;
+
+            for_each_possible_cpu(cpu)
+                count += READ_ONCE(per_cpu_ptr(&text_stats, cpu)->latency[stage][b]);
+            if (count)
+                seq_printf(m, "%s %llu %llu\n", stage_names[stage], 1ULL << b, count);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(text_latency);
 
 static struct file_operations fops = {
     .owner   = THIS_MODULE,
     .open    = text_open,
     .release = text_release,
-    .read    = text_read,
-    .write   = text_write
+    .read_iter = text_read_iter,
+    .write_iter = text_write_iter,
+    .splice_read = generic_file_splice_read,
+    .splice_write = iter_file_splice_write,
+    .fsync   = text_fsync,
+    .poll    = text_poll,
+    .mmap    = text_mmap,
+    .llseek  = no_llseek,
+    .unlocked_ioctl = text_ioctl,
 };
 
 static int __init text_driver_init(void) {
     int ret; 
 
-    my_device = kmalloc(sizeof(struct text_device), GFP_KERNEL);
+    if (xts_sector_size < 512 || xts_sector_size > 4096 || !is_power_of_2(xts_sector_size)) {
+        printk(KERN_ERR "%s: invalid xts_sector_size %d\n", DEVICE_NAME_CT, xts_sector_size); 
+        return -EINVAL;
+    }
+
+    if (ring_size < xts_sector_size || !is_power_of_2(ring_size)) {
+        printk(KERN_ERR "%s: invalid ring_size %u\n", DEVICE_NAME_CT, ring_size); 
+        return -EINVAL;
+    }
+
+    // Below one sector a carried-over partial unit could fill the queue for good
+    if (queue_depth && (queue_depth < xts_sector_size || queue_depth > ring_size)) {
+        printk(KERN_ERR "%s: invalid queue_depth %u\n", DEVICE_NAME_CT, queue_depth); 
+        return -EINVAL;
+    }
+
+    // One XTS item of a whole sector has to fit
+    if (bounce_size < xts_sector_size || !bounce_reserve) {
+        printk(KERN_ERR "%s: invalid bounce_size %u or bounce_reserve %u\n", DEVICE_NAME_CT, bounce_size, bounce_reserve); 
+        return -EINVAL;
+    }
+
+    if (strcmp(backend, "builtin") && strcmp(backend, "kcapi")) {
+        printk(KERN_ERR "%s: invalid backend '%s'\n", DEVICE_NAME_CT, backend); 
+        return -EINVAL;
+    }
+
+    // Pick the fastest cipher backend this CPU supports, once, at load
+    ret = aes_core_init(impl);
+    if (ret < 0) {
+        printk(KERN_ERR "%s: AES backend '%s' not available\n", DEVICE_NAME_CT, impl); 
+        return ret;
+    }
+
+    my_device = kzalloc(sizeof(struct text_device), GFP_KERNEL);
     if (!my_device) {
         printk(KERN_ERR "%s: Failed to allocate memory\n", DEVICE_NAME_CT); 
         return -ENOMEM;
     }
 
+    mutex_init(&my_device->lock);
+
+    // Whole cache lines per key, so no two schedules share one
+    text_key_cache = kmem_cache_create("kaes_key", sizeof(struct text_key), 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!text_key_cache) {
+        ret = -ENOMEM;
+        goto fail_alloc;
+    }
+
+    // Sessions are opened and closed all the time; their own cache keeps them off the kmalloc size classes
+    text_session_cache = kmem_cache_create("kaes_session", sizeof(struct text_session), 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!text_session_cache) {
+        ret = -ENOMEM;
+        goto fail_session_cache;
+    }
+
+    text_bounce_cache = kmem_cache_create("kaes_bounce", bounce_size, 0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!text_bounce_cache) {
+        ret = -ENOMEM;
+        goto fail_bounce_cache;
+    }
+
+    text_bounce_pool = mempool_create_slab_pool(bounce_reserve, text_bounce_cache);
+    if (!text_bounce_pool) {
+        ret = -ENOMEM;
+        goto fail_bounce_pool;
+    }
+
+    // A parallel call has at most one slice per CPU
+    text_chunks_cache = kmem_cache_create("kaes_chunks", nr_cpu_ids * sizeof(struct text_chunk), 0, 0, NULL);
+    if (!text_chunks_cache) {
+        ret = -ENOMEM;
+        goto fail_chunks_cache;
+    }
+
+    text_rings = kcalloc(ring_cache, sizeof(*text_rings), GFP_KERNEL);
+    if (ring_cache && !text_rings) {
+        ret = -ENOMEM;
+        goto fail_rings;
+    }
+
+    // Empty until sysfs sets one
+    my_device->key = text_key_alloc();
+    if (!my_device->key) {
+        ret = -ENOMEM;
+        goto fail_key;
+    }
+
+    // Async requests run here, on whichever CPU is free
+    text_wq = alloc_workqueue("kaes", WQ_UNBOUND, 0);
+    if (!text_wq) {
+        ret = -ENOMEM;
+        goto fail_wq;
+    }
+
     ret = alloc_chrdev_region(&my_device->dev_number, 0, 1, DEVICE_NAME_CT);
     if (ret < 0) {
-        goto fail_alloc;
+        goto fail_chrdev;
     }
 
     cdev_init(&my_device->cdev, &fops);
@@ -125,7 +2343,7 @@ static int __init text_driver_init(void) {
         goto fail_class_create;
     }
 
-    my_device->device = device_create(my_device->dev_class, NULL, my_device->dev_number, NULL, DEVICE_NAME_CT);
+    my_device->device = device_create(my_device->dev_class, NULL, my_device->dev_number, my_device, DEVICE_NAME_CT);
     if (IS_ERR(my_device->device)) {
         ret = PTR_ERR(my_device->device); 
         goto fail_device_create;
@@ -141,7 +2359,28 @@ static int __init text_driver_init(void) {
         goto fail_create_file; 
     }
 
-    printk(KERN_INFO "%s driver initialized!\n", DEVICE_NAME_CT); 
+    ret = device_create_file(my_device->device, &dev_attr_mode);
+    if (ret < 0) {
+        goto fail_create_file; 
+    }
+
+    ret = device_create_file(my_device->device, &dev_attr_armor);
+    if (ret < 0) {
+        goto fail_create_file; 
+    }
+
+    ret = device_create_file(my_device->device, &dev_attr_stats);
+    if (ret < 0) {
+        goto fail_create_file; 
+    }
+
+    // Optional, the driver works the same without debugfs
+    text_debugfs = debugfs_create_dir("kaes", NULL);
+    debugfs_create_file("latency", 0444, text_debugfs, NULL, &text_latency_fops);
+
+    printk(KERN_INFO "%s driver initialized (%s%s%s)!\n", DEVICE_NAME_CT,
+           aes_core_impl_name(), aes_have_clmul ? ", clmul" : "",
+           strcmp(backend, "kcapi") ? "" : ", kcapi streams"); 
     return 0; 
 
 // Error handling paths and driver exit
@@ -153,19 +2392,48 @@ fail_class_create:
     cdev_del(&my_device->cdev);
 fail_cdev_add:
     unregister_chrdev_region(my_device->dev_number, 1);
+fail_chrdev:
+    destroy_workqueue(text_wq);
+fail_wq:
+    text_key_put(my_device->key);
+fail_key:
+    kfree(text_rings);
+fail_rings:
+    kmem_cache_destroy(text_chunks_cache);
+fail_chunks_cache:
+    mempool_destroy(text_bounce_pool);
+fail_bounce_pool:
+    kmem_cache_destroy(text_bounce_cache);
+fail_bounce_cache:
+    kmem_cache_destroy(text_session_cache);
+fail_session_cache:
+    kmem_cache_destroy(text_key_cache);
 fail_alloc:
-    kfree(my_device); 
+    kfree_sensitive(my_device); 
     return ret; 
 }
 
 static void __exit text_driver_exit(void) {
+    debugfs_remove_recursive(text_debugfs);
+    device_remove_file(my_device->device, &dev_attr_stats);
+    device_remove_file(my_device->device, &dev_attr_armor);
+    device_remove_file(my_device->device, &dev_attr_mode);
     device_remove_file(my_device->device, &dev_attr_status);
     device_remove_file(my_device->device, &dev_attr_key);
     device_destroy(my_device->dev_class, my_device->dev_number);
     class_destroy(my_device->dev_class);
     unregister_chrdev_region(my_device->dev_number, 1);
     cdev_del(&my_device->cdev);
-    kfree(my_device);
+    destroy_workqueue(text_wq);
+    text_keys_destroy();
+    text_key_put(my_device->key);
+    text_rings_destroy();
+    kmem_cache_destroy(text_chunks_cache);
+    mempool_destroy(text_bounce_pool);
+    kmem_cache_destroy(text_bounce_cache);
+    kmem_cache_destroy(text_session_cache);
+    kmem_cache_destroy(text_key_cache);
+    kfree_sensitive(my_device);
     printk(KERN_INFO "%s driver removed!\n", DEVICE_NAME_CT); 
 }
 
@@ -174,5 +2442,5 @@ module_exit(text_driver_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Your Name"); 
-MODULE_DESCRIPTION("Sample character device driver with sysfs"); 
+MODULE_DESCRIPTION("AES-CBC/CTR/GCM/XTS character device driver with sysfs"); 
 MODULE_VERSION("1.0");
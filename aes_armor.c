@@ -0,0 +1,196 @@
+/*
+ * Hex and base64 codecs for armored streams, SWAR style: a u64 holds eight
+ * characters (hex) or four 16-bit lanes (base64), and range checks and
+ * alphabet offsets are worked out for every lane at once with adds and
+ * masks. Lanes are kept small enough that no add carries into the next.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#endif
+
+#include "aes_armor.h"
+
+#define REP8(x) (0x0101010101010101ULL * (u8)(x))    // @x in every byte
+#define REP16(x) (0x0001000100010001ULL * (u16)(x))  // @x in every 16-bit lane
+
+// Little-endian loads and stores of @n bytes; whole words compile to one access
+static inline u64 load_le(const void *p, unsigned int n) {
+    const u8 *b = p;
+    u64 v = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        v |= (u64)b[i] << (8 * i);
+    return v;
+}
+
+static inline void store_le(void *p, u64 v, unsigned int n) {
+    u8 *b = p;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        b[i] = v >> (8 * i);
+}
+
+// Four bytes, one per byte of @v, spread to one per 16-bit lane
+static inline u64 spread16(u64 v) {
+    v = (v | v << 16) & 0x0000ffff0000ffffULL;
+    return (v | v << 8) & REP16(0xff);
+}
+
+// The inverse: the low byte of each 16-bit lane, packed into 32 bits
+static inline u32 pack16(u64 v) {
+    v = (v | v >> 8) & 0x0000ffff0000ffffULL;
+    return (v | v >> 16) & 0xffffffffULL;
+}
+
+// Four bytes to eight hex digits, the high nibble of each byte first
+static inline u64 hex_encode4(u64 in) {
+    u64 t = spread16(in);
+    u64 n = (t >> 4 & REP16(0x0f)) | (t & REP16(0x0f)) << 8;
+    u64 letter = (n + REP8(6)) >> 4 & REP8(1);  // nibbles 10..15
+
+    return n + REP8('0') + letter * ('a' - '0' - 10);
+}
+
+void armor_hex_encode(char *dst, const u8 *src, size_t len) {
+    for (; len >= 4; len -= 4, src += 4, dst += 8)
+        store_le(dst, hex_encode4(load_le(src, 4)), 8);
+    if (len)
+        store_le(dst, hex_encode4(load_le(src, len)), 2 * len);
+}
+
+/*
+ * Eight hex digits to four bytes. Each lane is checked against '0'..'9' and,
+ * folded to lowercase, 'a'..'f': adding 0x80 - bound sets a lane's top bit
+ * exactly when it is at or above the bound.
+ */
+static inline int hex_decode8(u64 c, u32 *out) {
+    u64 lc = c | REP8(0x20);
+    u64 digit, alpha, n;
+
+    if (c & REP8(0x80))
+        return -EINVAL;
+    digit = (c + REP8(0x80 - '0')) & ~(c + REP8(0x80 - '9' - 1));
+    alpha = (lc + REP8(0x80 - 'a')) & ~(lc + REP8(0x80 - 'f' - 1));
+    if (((digit | alpha) & REP8(0x80)) != REP8(0x80))
+        return -EINVAL;
+
+    // Letters have bit 6 set, digits don't
+    n = (c & REP8(0x0f)) + (c >> 6 & REP8(1)) * 9;
+    *out = pack16((n & REP16(0x0f)) << 4 | (n >> 8 & REP16(0x0f)));
+    return 0;
+}
+
+int armor_hex_decode(u8 *dst, const char *src, size_t len) {
+    size_t n = len / 2;
+    u32 v;
+
+    if (len % 2)
+        return -EINVAL;
+
+    for (; len >= 8; len -= 8, src += 8, dst += 4) {
+        if (hex_decode8(load_le(src, 8), &v))
+            return -EINVAL;
+        store_le(dst, v, 4);
+    }
+    if (len) {
+        // Pad the last few digits with '0's to a whole word
+        if (hex_decode8(load_le(src, len) | (REP8('0') << (8 * len)), &v))
+            return -EINVAL;
+        store_le(dst, v, len / 2);
+    }
+    return n;
+}
+
+/*
+ * One 24-bit group to four base64 characters. The six-bit indices sit in
+ * 16-bit lanes; the offset from each index to its character grows by one
+ * step per alphabet range the index has reached (mod 256).
+ */
+static inline u32 base64_encode3(u32 v) {
+    u64 i = (u64)(v >> 18) | (u64)(v >> 12 & 63) << 16 | (u64)(v >> 6 & 63) << 32 | (u64)(v & 63) << 48;
+    u64 off = REP16('A');
+
+#define GE(k) ((i + REP16(0x80 - (k))) >> 7 & REP16(1))
+    off += GE(26) * ('a' - 'A' - 26);
+    off += GE(52) * (u8)('0' - 'a' - 26);
+    off += GE(62) * (u8)('+' - '0' - 10);
+    off += GE(63) * ('/' - '+' - 1);
+#undef GE
+
+    return pack16((i + off) & REP16(0xff));
+}
+
+size_t armor_base64_encode(char *dst, const u8 *src, size_t len) {
+    char *start = dst;
+    u32 v;
+
+    for (; len >= 3; len -= 3, src += 3, dst += 4)
+        store_le(dst, base64_encode3(src[0] << 16 | src[1] << 8 | src[2]), 4);
+
+    if (len) {
+        v = src[0] << 16 | (len > 1 ? src[1] << 8 : 0);
+        store_le(dst, base64_encode3(v), 4);
+        dst[3] = '=';
+        if (len == 1)
+            dst[2] = '=';
+        dst += 4;
+    }
+    return dst - start;
+}
+
+/*
+ * Four base64 characters to a 24-bit group. Every lane must fall in exactly
+ * one of the five alphabet ranges, which also maps it to its index.
+ */
+static inline int base64_decode4(u32 in, u32 *out) {
+    u64 c = spread16(in);
+    u64 upper, lower, digit, plus, slash, v;
+
+#define GE(k) ((c + REP16(0x100 - (k))) >> 8 & REP16(1))
+    upper = GE('A') - GE('Z' + 1);
+    lower = GE('a') - GE('z' + 1);
+    digit = GE('0') - GE('9' + 1);
+    plus = GE('+') - GE('+' + 1);
+    slash = GE('/') - GE('/' + 1);
+#undef GE
+
+    if (upper + lower + digit + plus + slash != REP16(1))
+        return -EINVAL;
+
+    v = c + upper * (u8)(0 - 'A') + lower * (u8)(26 - 'a') + digit * (52 - '0') + plus * (62 - '+') +
+        slash * (63 - '/');
+    v &= REP16(0xff);
+    *out = (v & 63) << 18 | (v >> 16 & 63) << 12 | (v >> 32 & 63) << 6 | (v >> 48 & 63);
+    return 0;
+}
+
+int armor_base64_decode(u8 *dst, const char *src, size_t len) {
+    u8 *start = dst;
+    char last[4];
+    unsigned int n;
+    u32 v;
+
+    if (len % 4 == 1)
+        return -EINVAL;
+
+    for (; len > 4 || (len == 4 && src[3] != '='); len -= 4, src += 4, dst += 3) {
+        if (base64_decode4(load_le(src, 4), &v))
+            return -EINVAL;
+        store_le(dst, (v >> 16 & 0xff) | (v & 0xff00) | (v & 0xff) << 16, 3);
+    }
+    if (!len)
+        return dst - start;
+
+    // The final group: padded, or 2 or 3 characters without padding
+    memcpy(last, src, len);
+    n = len == 4 ? (src[2] == '=' ? 1 : 2) : len - 1;
+    memset(last + n + 1, 'A', 3 - n);
+    if (base64_decode4(load_le(last, 4), &v))
+        return -EINVAL;
+    store_le(dst, (v >> 16 & 0xff) | (v & 0xff00) | (v & 0xff) << 16, n);
+    return dst + n - start;
+}
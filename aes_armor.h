@@ -0,0 +1,53 @@
+#ifndef _AES_ARMOR_H
+#define _AES_ARMOR_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include "aes_user.h"
+#endif
+
+/*
+ * Text armor for ciphertext: lowercase hex and standard base64 (RFC 4648,
+ * with '=' padding). The codecs work a 64-bit word at a time, several
+ * characters per operation, and need no FPU state, so they can run on
+ * short chunks inside the stream's copy loops.
+ */
+
+// Encodes @len bytes as 2 * @len hex digits
+void armor_hex_encode(char *dst, const u8 *src, size_t len);
+
+/**
+ * armor_hex_decode - Decodes hex digits, either case.
+ * @dst: Receives @len / 2 bytes.
+ * @src: The digits.
+ * @len: An even number of digits.
+ *
+ * Returns:
+ *   The number of bytes written, -EINVAL for an odd length or a non-hex digit.
+ */
+int armor_hex_decode(u8 *dst, const char *src, size_t len);
+
+// Base64 characters for @len bytes, padding included
+static inline size_t armor_base64_len(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+// Encodes @len bytes; a final group of 1 or 2 bytes is padded with '='
+size_t armor_base64_encode(char *dst, const u8 *src, size_t len);
+
+/**
+ * armor_base64_decode - Decodes base64 text.
+ * @dst: Receives up to @len / 4 * 3 bytes.
+ * @src: The characters.
+ * @len: Whole groups of 4, or a final unpadded group of 2 or 3.
+ *
+ * Only the last group may carry '=' padding.
+ *
+ * Returns:
+ *   The number of bytes written, -EINVAL for a character outside the
+ *   alphabet, misplaced padding or a length that can't end a stream.
+ */
+int armor_base64_decode(u8 *dst, const char *src, size_t len);
+
+#endif /* _AES_ARMOR_H */
@@ -0,0 +1,371 @@
+/*
+ * Bitsliced, constant-time AES.
+ *
+ * No table lookups and no data-dependent branches: the state of four blocks
+ * is spread over eight 64-bit words, word i holding bit i of all 64 bytes,
+ * and SubBytes is evaluated as a boolean circuit on those words (the
+ * Boyar-Peralta S-box circuit, 113 gates). Bulk work runs two such states
+ * side by side, i.e. eight blocks, so the integer pipelines stay busy; a
+ * tail of four blocks or fewer runs one.
+ *
+ * Bit p of a slice word is block (p & 3), column ((p >> 2) & 3), row (p >> 4).
+ * With rows in separate 16-bit lanes, ShiftRows is a rotation inside each
+ * lane and MixColumns a rotation of the whole word by one lane.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#endif
+
+#include "aes_core.h"
+
+#define BS_BLOCKS 8
+
+static __always_inline void bs_sbox(u64 *q) {
+    u64 x0, x1, x2, x3, x4, x5, x6, x7;
+    u64 y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+    u64 z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17;
+    u64 t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    u64 t20, t21, t22, t23, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    u64 t40, t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    u64 t60, t61, t62, t63, t64, t65, t66, t67;
+    u64 s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+    x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+    // Top linear transformation
+    y14 = x3 ^ x5;   y13 = x0 ^ x6;   y9 = x0 ^ x3;    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;    y1 = t0 ^ x7;    y4 = y1 ^ x3;    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;    y5 = y1 ^ x6;    y3 = y5 ^ y8;    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;   y20 = t1 ^ x1;   y6 = y15 ^ x7;   y10 = y15 ^ t0;
+    y11 = y20 ^ y9;  y7 = x7 ^ y11;   y17 = y10 ^ y11; y19 = y10 ^ y8;
+    y16 = t0 ^ y11;  y21 = y13 ^ y16; y18 = x0 ^ y16;
+
+    // Non-linear section: inversion in GF(2^8)
+    t2 = y12 & y15;  t3 = y3 & y6;    t4 = t3 ^ t2;    t5 = y4 & x7;
+    t6 = t5 ^ t2;    t7 = y13 & y16;  t8 = y5 & y1;    t9 = t8 ^ t7;
+    t10 = y2 & y7;   t11 = t10 ^ t7;  t12 = y9 & y11;  t13 = y14 & y17;
+    t14 = t13 ^ t12; t15 = y8 & y10;  t16 = t15 ^ t12; t17 = t4 ^ t14;
+    t18 = t6 ^ t16;  t19 = t9 ^ t14;  t20 = t11 ^ t16; t21 = t17 ^ y20;
+    t22 = t18 ^ y19; t23 = t19 ^ y21; t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22; t26 = t21 & t23; t27 = t24 ^ t26; t28 = t25 & t27;
+    t29 = t28 ^ t22; t30 = t23 ^ t24; t31 = t22 ^ t26; t32 = t31 & t30;
+    t33 = t32 ^ t24; t34 = t23 ^ t33; t35 = t27 ^ t33; t36 = t24 & t35;
+    t37 = t36 ^ t34; t38 = t27 ^ t36; t39 = t29 & t38; t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37; t42 = t29 ^ t33; t43 = t29 ^ t40; t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;  z1 = t37 & y6;   z2 = t33 & x7;   z3 = t43 & y16;
+    z4 = t40 & y1;   z5 = t29 & y7;   z6 = t42 & y11;  z7 = t45 & y17;
+    z8 = t41 & y10;  z9 = t44 & y12;  z10 = t37 & y3;  z11 = t33 & y4;
+    z12 = t43 & y13; z13 = t40 & y5;  z14 = t29 & y2;  z15 = t42 & y9;
+    z16 = t45 & y14; z17 = t41 & y8;
+
+    // Bottom linear transformation, including the affine constant
+    t46 = z15 ^ z16; t47 = z10 ^ z11; t48 = z5 ^ z13;  t49 = z9 ^ z10;
+    t50 = z2 ^ z12;  t51 = z2 ^ z5;   t52 = z7 ^ z8;   t53 = z0 ^ z3;
+    t54 = z6 ^ z7;   t55 = z16 ^ z17; t56 = z12 ^ t48; t57 = t50 ^ t53;
+    t58 = z4 ^ t46;  t59 = z3 ^ t54;  t60 = t46 ^ t57; t61 = z14 ^ t57;
+    t62 = t52 ^ t58; t63 = t49 ^ t58; t64 = z4 ^ t59;  t65 = t61 ^ t62;
+    t66 = z1 ^ t63;  s0 = t59 ^ t63;  s6 = t56 ^ ~t62; s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65; s3 = t53 ^ t66;  s4 = t51 ^ t66;  s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;  s2 = t55 ^ ~t67;
+
+    q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+    q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+// Inverse of the S-box affine map (x -> L^-1 x ^ 0x05), in place
+static __always_inline void bs_inv_affine(u64 *q) {
+    u64 x0 = q[0], x1 = q[1], x2 = q[2], x3 = q[3], x4 = q[4], x5 = q[5], x6 = q[6], x7 = q[7];
+
+    q[0] = ~(x2 ^ x5 ^ x7);
+    q[1] = x3 ^ x6 ^ x0;
+    q[2] = ~(x4 ^ x7 ^ x1);
+    q[3] = x5 ^ x0 ^ x2;
+    q[4] = x6 ^ x1 ^ x3;
+    q[5] = x7 ^ x2 ^ x4;
+    q[6] = x0 ^ x3 ^ x5;
+    q[7] = x1 ^ x4 ^ x6;
+}
+
+// InvSubBytes(x) = A^-1(SubBytes(A^-1(x))), since SubBytes(x) = A(x^-1)
+static __always_inline void bs_inv_sbox(u64 *q) {
+    bs_inv_affine(q);
+    bs_sbox(q);
+    bs_inv_affine(q);
+}
+
+static __always_inline u64 bs_shift_row(u64 x) {
+    return (x & 0x000000000000ffffULL) |
+           ((x >> 4) & 0x000000000fff0000ULL) | ((x << 12) & 0x00000000f0000000ULL) |
+           ((x >> 8) & 0x000000ff00000000ULL) | ((x << 8) & 0x0000ff0000000000ULL) |
+           ((x >> 12) & 0x000f000000000000ULL) | ((x << 4) & 0xfff0000000000000ULL);
+}
+
+static __always_inline u64 bs_inv_shift_row(u64 x) {
+    return (x & 0x000000000000ffffULL) |
+           ((x << 4) & 0x00000000fff00000ULL) | ((x >> 12) & 0x00000000000f0000ULL) |
+           ((x >> 8) & 0x000000ff00000000ULL) | ((x << 8) & 0x0000ff0000000000ULL) |
+           ((x << 12) & 0xf000000000000000ULL) | ((x >> 4) & 0x0fff000000000000ULL);
+}
+
+static __always_inline u64 rotr64(u64 x, unsigned int n) {
+    return (x >> n) | (x << (64 - n));
+}
+
+// Multiply every byte by x in GF(2^8), on bitsliced words
+static __always_inline void bs_xtime(u64 *t, const u64 *a) {
+    t[0] = a[7];
+    t[1] = a[0] ^ a[7];
+    t[2] = a[1];
+    t[3] = a[2] ^ a[7];
+    t[4] = a[3] ^ a[7];
+    t[5] = a[4];
+    t[6] = a[5];
+    t[7] = a[6];
+}
+
+// out[row] = 2 a[row] ^ 3 a[row + 1] ^ a[row + 2] ^ a[row + 3]
+static __always_inline void bs_mix_columns(u64 *q) {
+    u64 a[8], t[8];
+    unsigned int i;
+
+    for (i = 0; i < 8; i++)
+        a[i] = q[i] ^ rotr64(q[i], 16);
+    bs_xtime(t, a);
+    for (i = 0; i < 8; i++)
+        q[i] = t[i] ^ rotr64(q[i], 16) ^ rotr64(q[i], 32) ^ rotr64(q[i], 48);
+}
+
+// InvMixColumns = MixColumns after adding 4 (a[row] ^ a[row + 2]) to every row
+static __always_inline void bs_inv_mix_columns(u64 *q) {
+    u64 a[8], t[8], u[8];
+    unsigned int i;
+
+    for (i = 0; i < 8; i++)
+        a[i] = q[i] ^ rotr64(q[i], 32);
+    bs_xtime(t, a);
+    bs_xtime(u, t);
+    for (i = 0; i < 8; i++)
+        q[i] ^= u[i];
+    bs_mix_columns(q);
+}
+
+static __always_inline u32 load_le32(const u8 *p) {
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static __always_inline void store_le32(u8 *p, u32 v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// Bytes of x to the even byte lanes of a 64-bit word, and back
+static __always_inline u64 bs_spread(u32 x) {
+    u64 v = x;
+
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    return (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+}
+
+static __always_inline u32 bs_unspread(u64 v) {
+    v &= 0x00ff00ff00ff00ffULL;
+    v = (v | (v >> 8)) & 0x0000ffff0000ffffULL;
+    return v | (v >> 16);
+}
+
+#define BS_SWAPMOVE(a, b, mask, n) do {         \
+        u64 t_ = (((a) >> (n)) ^ (b)) & (mask); \
+        (b) ^= t_;                              \
+        (a) ^= t_ << (n);                       \
+    } while (0)
+
+/*
+ * Swaps the word index with the bit-within-byte index across q[0..7]: after
+ * it, q[i] holds bit i of every byte and the old word index sits in the low
+ * three bits of each position. Being an involution, it also unpacks.
+ */
+static __always_inline void bs_ortho(u64 *q) {
+    BS_SWAPMOVE(q[0], q[1], 0x5555555555555555ULL, 1);
+    BS_SWAPMOVE(q[2], q[3], 0x5555555555555555ULL, 1);
+    BS_SWAPMOVE(q[4], q[5], 0x5555555555555555ULL, 1);
+    BS_SWAPMOVE(q[6], q[7], 0x5555555555555555ULL, 1);
+
+    BS_SWAPMOVE(q[0], q[2], 0x3333333333333333ULL, 2);
+    BS_SWAPMOVE(q[1], q[3], 0x3333333333333333ULL, 2);
+    BS_SWAPMOVE(q[4], q[6], 0x3333333333333333ULL, 2);
+    BS_SWAPMOVE(q[5], q[7], 0x3333333333333333ULL, 2);
+
+    BS_SWAPMOVE(q[0], q[4], 0x0f0f0f0f0f0f0f0fULL, 4);
+    BS_SWAPMOVE(q[1], q[5], 0x0f0f0f0f0f0f0f0fULL, 4);
+    BS_SWAPMOVE(q[2], q[6], 0x0f0f0f0f0f0f0f0fULL, 4);
+    BS_SWAPMOVE(q[3], q[7], 0x0f0f0f0f0f0f0f0fULL, 4);
+}
+
+/*
+ * Spread four blocks into eight slice words. Word b (b + 4) gets the even
+ * (odd) columns of block b with the rows of the two columns interleaved, so
+ * that after bs_ortho() byte (row r, column c) of block b sits on bit
+ * 16r + 4c + b.
+ */
+static void bs_pack(u64 *q, const u8 *in) {
+    unsigned int b;
+
+    for (b = 0; b < 4; b++, in += AES_BLOCK_SIZE) {
+        q[b] = bs_spread(load_le32(in)) | (bs_spread(load_le32(in + 8)) << 8);
+        q[b + 4] = bs_spread(load_le32(in + 4)) | (bs_spread(load_le32(in + 12)) << 8);
+    }
+    bs_ortho(q);
+}
+
+static void bs_unpack(u8 *out, u64 *q) {
+    unsigned int b;
+
+    bs_ortho(q);
+    for (b = 0; b < 4; b++, out += AES_BLOCK_SIZE) {
+        store_le32(out, bs_unspread(q[b]));
+        store_le32(out + 8, bs_unspread(q[b] >> 8));
+        store_le32(out + 4, bs_unspread(q[b + 4]));
+        store_le32(out + 12, bs_unspread(q[b + 4] >> 8));
+    }
+}
+
+static __always_inline void bs_add_round_key(u64 *q, const u64 *sk, unsigned int groups) {
+    unsigned int g, i;
+
+    for (g = 0; g < groups; g++)
+        for (i = 0; i < 8; i++)
+            q[8 * g + i] ^= sk[i];
+}
+
+// q[8g..8g+7] is group g of four blocks; @groups is 1 or 2, a constant
+static __always_inline void bs_encrypt_groups(const struct aes_ctx *ctx, u64 *q, unsigned int groups) {
+    const u64 *sk = ctx->key_bs;
+    unsigned int r, g, i;
+
+    bs_add_round_key(q, sk, groups);
+    for (r = 1; r <= ctx->rounds; r++) {
+        for (g = 0; g < groups; g++)
+            bs_sbox(q + 8 * g);
+        for (i = 0; i < 8 * groups; i++)
+            q[i] = bs_shift_row(q[i]);
+        if (r != ctx->rounds)
+            for (g = 0; g < groups; g++)
+                bs_mix_columns(q + 8 * g);
+        bs_add_round_key(q, sk + 8 * r, groups);
+    }
+}
+
+static __always_inline void bs_decrypt_groups(const struct aes_ctx *ctx, u64 *q, unsigned int groups) {
+    const u64 *sk = ctx->key_bs;
+    unsigned int r, g, i;
+
+    bs_add_round_key(q, sk + 8 * ctx->rounds, groups);
+    for (r = ctx->rounds; r-- > 0;) {
+        for (i = 0; i < 8 * groups; i++)
+            q[i] = bs_inv_shift_row(q[i]);
+        for (g = 0; g < groups; g++)
+            bs_inv_sbox(q + 8 * g);
+        bs_add_round_key(q, sk + 8 * r, groups);
+        if (r)
+            for (g = 0; g < groups; g++)
+                bs_inv_mix_columns(q + 8 * g);
+    }
+}
+
+static void bs_encrypt8(const struct aes_ctx *ctx, u64 *q) {
+    bs_encrypt_groups(ctx, q, 2);
+}
+
+static void bs_decrypt8(const struct aes_ctx *ctx, u64 *q) {
+    bs_decrypt_groups(ctx, q, 2);
+}
+
+static void bs_encrypt4(const struct aes_ctx *ctx, u64 *q) {
+    bs_encrypt_groups(ctx, q, 1);
+}
+
+static void bs_decrypt4(const struct aes_ctx *ctx, u64 *q) {
+    bs_decrypt_groups(ctx, q, 1);
+}
+
+/*
+ * Whole groups of eight go through crypt8. A shorter tail is zero padded
+ * and, if it fits in four blocks, run through crypt4 on a single slice
+ * state, which costs half as much. Single blocks and serial chains (CBC
+ * encryption, the XTS tweak, GCM's H and J0) land there too, so every block
+ * takes the same circuit and nothing is looked up by key or data.
+ */
+static void bs_crypt(const struct aes_ctx *ctx, void (*crypt8)(const struct aes_ctx *, u64 *),
+                     void (*crypt4)(const struct aes_ctx *, u64 *),
+                     u8 *dst, const u8 *src, unsigned int nblocks) {
+    u8 buf[BS_BLOCKS * AES_BLOCK_SIZE];
+    u64 q[16];
+
+    for (; nblocks >= BS_BLOCKS; nblocks -= BS_BLOCKS) {
+        bs_pack(q, src);
+        bs_pack(q + 8, src + 4 * AES_BLOCK_SIZE);
+        crypt8(ctx, q);
+        bs_unpack(dst, q);
+        bs_unpack(dst + 4 * AES_BLOCK_SIZE, q + 8);
+        src += BS_BLOCKS * AES_BLOCK_SIZE;
+        dst += BS_BLOCKS * AES_BLOCK_SIZE;
+    }
+
+    if (!nblocks)
+        return;
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, src, nblocks * AES_BLOCK_SIZE);
+    bs_pack(q, buf);
+    if (nblocks <= BS_BLOCKS / 2) {
+        crypt4(ctx, q);
+        bs_unpack(buf, q);
+    } else {
+        bs_pack(q + 8, buf + 4 * AES_BLOCK_SIZE);
+        crypt8(ctx, q);
+        bs_unpack(buf, q);
+        bs_unpack(buf + 4 * AES_BLOCK_SIZE, q + 8);
+    }
+    memcpy(dst, buf, nblocks * AES_BLOCK_SIZE);
+}
+
+static void bs_encrypt(const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int nblocks) {
+    bs_crypt(ctx, bs_encrypt8, bs_encrypt4, dst, src, nblocks);
+}
+
+static void bs_decrypt(const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int nblocks) {
+    bs_crypt(ctx, bs_decrypt8, bs_decrypt4, dst, src, nblocks);
+}
+
+// Broadcast every round key bit over the four block positions of its nibble
+static void bs_setkey(struct aes_ctx *ctx) {
+    unsigned int r, i, p;
+
+    for (r = 0; r <= ctx->rounds; r++) {
+        u64 *sk = ctx->key_bs + 8 * r;
+
+        for (i = 0; i < 8; i++) {
+            sk[i] = 0;
+            for (p = 0; p < AES_BLOCK_SIZE; p++) {
+                unsigned int row = p & 3, col = p >> 2;
+                u64 bit = (ctx->key_enc[4 * r + col] >> (8 * row + i)) & 1;
+
+                // Branch-free, the key must not leak through timing either
+                sk[i] |= (0xfULL * bit) << (16 * row + 4 * col);
+            }
+        }
+    }
+}
+
+const struct aes_impl aes_impl_bitslice = {
+    .name    = "bitslice",
+    .setkey  = bs_setkey,
+    .encrypt = bs_encrypt,
+    .decrypt = bs_decrypt,
+};
@@ -0,0 +1,337 @@
+/*
+ * ARMv8 Crypto Extensions backend (arm64).
+ *
+ * AESE/AESMC and AESD/AESIMC through the NEON intrinsics. The Makefile
+ * builds this file with +crypto and without -mgeneral-regs-only; everything
+ * here runs between kernel_neon_begin()/kernel_neon_end().
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/cpufeature.h>
+#include <asm/neon.h>
+#include <asm/neon-intrinsics.h>
+#endif
+
+#include "aes_core.h"
+
+#define CE_ENC(b, k) b = vaesmcq_u8(vaeseq_u8(b, k))
+#define CE_DEC(b, k) b = vaesimcq_u8(vaesdq_u8(b, k))
+
+// One AES round on eight independent blocks, so the AES unit pipeline stays full
+#define CE_ROUND8(op, k) do {                       \
+        op(b0, k); op(b1, k); op(b2, k); op(b3, k); \
+        op(b4, k); op(b5, k); op(b6, k); op(b7, k); \
+    } while (0)
+
+#define CE_LOAD8(src) do {                                  \
+        b0 = vld1q_u8(src);       b1 = vld1q_u8(src + 16);  \
+        b2 = vld1q_u8(src + 32);  b3 = vld1q_u8(src + 48);  \
+        b4 = vld1q_u8(src + 64);  b5 = vld1q_u8(src + 80);  \
+        b6 = vld1q_u8(src + 96);  b7 = vld1q_u8(src + 112); \
+    } while (0)
+
+/*
+ * The last AESE/AESD has no MixColumns and the final round key is a plain
+ * XOR; both directions share that tail.
+ */
+#define CE_FINAL8(last, k, kl) do {                                     \
+        b0 = veorq_u8(last(b0, k), kl); b1 = veorq_u8(last(b1, k), kl); \
+        b2 = veorq_u8(last(b2, k), kl); b3 = veorq_u8(last(b3, k), kl); \
+        b4 = veorq_u8(last(b4, k), kl); b5 = veorq_u8(last(b5, k), kl); \
+        b6 = veorq_u8(last(b6, k), kl); b7 = veorq_u8(last(b7, k), kl); \
+    } while (0)
+
+#define CE_XOR8(src) do {                                                              \
+        b0 = veorq_u8(b0, vld1q_u8(src));      b1 = veorq_u8(b1, vld1q_u8(src + 16));  \
+        b2 = veorq_u8(b2, vld1q_u8(src + 32)); b3 = veorq_u8(b3, vld1q_u8(src + 48));  \
+        b4 = veorq_u8(b4, vld1q_u8(src + 64)); b5 = veorq_u8(b5, vld1q_u8(src + 80));  \
+        b6 = veorq_u8(b6, vld1q_u8(src + 96)); b7 = veorq_u8(b7, vld1q_u8(src + 112)); \
+    } while (0)
+
+#define CE_STORE8(dst) do {                              \
+        vst1q_u8(dst, b0);      vst1q_u8(dst + 16, b1);  \
+        vst1q_u8(dst + 32, b2); vst1q_u8(dst + 48, b3);  \
+        vst1q_u8(dst + 64, b4); vst1q_u8(dst + 80, b5);  \
+        vst1q_u8(dst + 96, b6); vst1q_u8(dst + 112, b7); \
+    } while (0)
+
+/*
+ * The AESE+AESMC (or AESD+AESIMC) rounds, k[0] to k[rounds - 2], written
+ * out. @rounds is a constant wherever this is expanded, so the key size
+ * tests fold away and no loop is left.
+ */
+#define CE_MIDDLE(ROUND, rounds) do {                                    \
+        ROUND(k[0]); ROUND(k[1]); ROUND(k[2]); ROUND(k[3]); ROUND(k[4]); \
+        ROUND(k[5]); ROUND(k[6]); ROUND(k[7]); ROUND(k[8]);              \
+        if ((rounds) > 10) {                                             \
+            ROUND(k[9]); ROUND(k[10]);                                   \
+        }                                                                \
+        if ((rounds) > 12) {                                             \
+            ROUND(k[11]); ROUND(k[12]);                                  \
+        }                                                                \
+    } while (0)
+
+#define CE_ENC8(key) CE_ROUND8(CE_ENC, key)
+#define CE_DEC8(key) CE_ROUND8(CE_DEC, key)
+#define CE_ENC1(key) CE_ENC(b0, key)
+#define CE_DEC1(key) CE_DEC(b0, key)
+
+static __always_inline void ce_load_keys(uint8x16_t *k, const u32 *key, unsigned int rounds) {
+    unsigned int r;
+
+    for (r = 0; r <= rounds; r++)
+        k[r] = vld1q_u8((const u8 *)key + r * AES_BLOCK_SIZE);
+}
+
+static __always_inline void ce_encrypt(const struct aes_ctx *ctx, unsigned int rounds, u8 *dst, const u8 *src,
+                                       unsigned int nblocks) {
+    uint8x16_t k[AES_MAX_ROUNDS + 1];
+    uint8x16_t b0, b1, b2, b3, b4, b5, b6, b7;
+
+    ce_load_keys(k, ctx->key_enc, rounds);
+
+    for (; nblocks >= 8; nblocks -= 8) {
+        CE_LOAD8(src);
+        CE_MIDDLE(CE_ENC8, rounds);
+        CE_FINAL8(vaeseq_u8, k[rounds - 1], k[rounds]);
+        CE_STORE8(dst);
+        src += 8 * AES_BLOCK_SIZE;
+        dst += 8 * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        b0 = vld1q_u8(src);
+        CE_MIDDLE(CE_ENC1, rounds);
+        b0 = veorq_u8(vaeseq_u8(b0, k[rounds - 1]), k[rounds]);
+        vst1q_u8(dst, b0);
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+}
+
+static __always_inline void ce_decrypt(const struct aes_ctx *ctx, unsigned int rounds, u8 *dst, const u8 *src,
+                                       unsigned int nblocks) {
+    uint8x16_t k[AES_MAX_ROUNDS + 1];
+    uint8x16_t b0, b1, b2, b3, b4, b5, b6, b7;
+
+    ce_load_keys(k, ctx->key_dec, rounds);
+
+    for (; nblocks >= 8; nblocks -= 8) {
+        CE_LOAD8(src);
+        CE_MIDDLE(CE_DEC8, rounds);
+        CE_FINAL8(vaesdq_u8, k[rounds - 1], k[rounds]);
+        CE_STORE8(dst);
+        src += 8 * AES_BLOCK_SIZE;
+        dst += 8 * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        b0 = vld1q_u8(src);
+        CE_MIDDLE(CE_DEC1, rounds);
+        b0 = veorq_u8(vaesdq_u8(b0, k[rounds - 1]), k[rounds]);
+        vst1q_u8(dst, b0);
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+}
+
+static __always_inline void ce_cbc_encrypt(const struct aes_ctx *ctx, unsigned int rounds, u8 *iv, u8 *dst,
+                                           const u8 *src, unsigned int nblocks) {
+    uint8x16_t k[AES_MAX_ROUNDS + 1];
+    uint8x16_t b0 = vld1q_u8(iv);
+
+    ce_load_keys(k, ctx->key_enc, rounds);
+
+    // The chain value never leaves the register between blocks
+    for (; nblocks; nblocks--) {
+        b0 = veorq_u8(b0, vld1q_u8(src));
+        CE_MIDDLE(CE_ENC1, rounds);
+        b0 = veorq_u8(vaeseq_u8(b0, k[rounds - 1]), k[rounds]);
+        vst1q_u8(dst, b0);
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+
+    vst1q_u8(iv, b0);
+}
+
+/*
+ * CTR counters live in a vector as hi, lo lanes; VREV64 on the bytes turns
+ * one into its big-endian counter block.
+ */
+static __always_inline uint8x16_t ce_ctr_block(uint64x2_t c) {
+    return vrev64q_u8(vreinterpretq_u8_u64(c));
+}
+
+// Counter block @i past hi:lo, carrying into the high half
+static __always_inline uint8x16_t ce_ctr_carry(u64 hi, u64 lo, u64 i) {
+    return ce_ctr_block((uint64x2_t){ hi + (lo + i < lo), lo + i });
+}
+
+// Advances the counter, in both its scalar and vector forms
+static __always_inline void ce_ctr_add(uint64x2_t *c, u64 *hi, u64 *lo, u64 n) {
+    *lo += n;
+    if (likely(*lo >= n)) {
+        *c = vaddq_u64(*c, (uint64x2_t){ 0, n });
+    } else {
+        (*hi)++;
+        *c = (uint64x2_t){ *hi, *lo };
+    }
+}
+
+/*
+ * Eight counter blocks from c. The common case adds 1..7 to the low lane
+ * in registers; a batch that wraps the low half builds its lanes from the
+ * scalar halves instead.
+ */
+#define CE_CTR8() do {                                                       \
+        if (likely(lo <= ~0ULL - 7)) {                                       \
+            b0 = ce_ctr_block(c);                                            \
+            b1 = ce_ctr_block(vaddq_u64(c, (uint64x2_t){ 0, 1 }));           \
+            b2 = ce_ctr_block(vaddq_u64(c, (uint64x2_t){ 0, 2 }));           \
+            b3 = ce_ctr_block(vaddq_u64(c, (uint64x2_t){ 0, 3 }));           \
+            b4 = ce_ctr_block(vaddq_u64(c, (uint64x2_t){ 0, 4 }));           \
+            b5 = ce_ctr_block(vaddq_u64(c, (uint64x2_t){ 0, 5 }));           \
+            b6 = ce_ctr_block(vaddq_u64(c, (uint64x2_t){ 0, 6 }));           \
+            b7 = ce_ctr_block(vaddq_u64(c, (uint64x2_t){ 0, 7 }));           \
+        } else {                                                             \
+            b0 = ce_ctr_carry(hi, lo, 0); b1 = ce_ctr_carry(hi, lo, 1);      \
+            b2 = ce_ctr_carry(hi, lo, 2); b3 = ce_ctr_carry(hi, lo, 3);      \
+            b4 = ce_ctr_carry(hi, lo, 4); b5 = ce_ctr_carry(hi, lo, 5);      \
+            b6 = ce_ctr_carry(hi, lo, 6); b7 = ce_ctr_carry(hi, lo, 7);      \
+        }                                                                    \
+        ce_ctr_add(&c, &hi, &lo, 8);                                         \
+    } while (0)
+
+static __always_inline void ce_ctr_crypt(const struct aes_ctx *ctx, unsigned int rounds, u8 *ctr, u8 *dst,
+                                         const u8 *src, unsigned int nblocks) {
+    uint8x16_t k[AES_MAX_ROUNDS + 1];
+    uint8x16_t b0, b1, b2, b3, b4, b5, b6, b7;
+    u64 hi = aes_load_be64(ctr), lo = aes_load_be64(ctr + 8);
+    uint64x2_t c = { hi, lo };
+
+    ce_load_keys(k, ctx->key_enc, rounds);
+
+    // Eight counters in flight, built and XORed with the keystream in registers
+    for (; nblocks >= 8; nblocks -= 8) {
+        CE_CTR8();
+        CE_MIDDLE(CE_ENC8, rounds);
+        CE_FINAL8(vaeseq_u8, k[rounds - 1], k[rounds]);
+        CE_XOR8(src);
+        CE_STORE8(dst);
+        src += 8 * AES_BLOCK_SIZE;
+        dst += 8 * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        b0 = ce_ctr_block(c);
+        ce_ctr_add(&c, &hi, &lo, 1);
+        CE_MIDDLE(CE_ENC1, rounds);
+        b0 = veorq_u8(vaeseq_u8(b0, k[rounds - 1]), k[rounds]);
+        vst1q_u8(dst, veorq_u8(b0, vld1q_u8(src)));
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+
+    aes_store_be64(ctr, hi);
+    aes_store_be64(ctr + 8, lo);
+}
+
+/*
+ * GHASH with PMULL. RBIT on each byte turns GCM's reflected bit order into
+ * plain polynomials (bit i of the 128-bit little-endian value is x^i), so
+ * the product is a schoolbook 64x64 multiply and the reduction folds the
+ * high half back in twice with x^128 = x^7 + x^2 + x + 1.
+ */
+static inline uint8x16_t ce_gfmul(uint8x16_t a, uint8x16_t b) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    poly64x2_t pa = vreinterpretq_p64_u8(a), pb = vreinterpretq_p64_u8(b);
+    poly64_t a0 = vgetq_lane_p64(pa, 0), a1 = vgetq_lane_p64(pa, 1);
+    poly64_t b0 = vgetq_lane_p64(pb, 0), b1 = vgetq_lane_p64(pb, 1);
+    uint8x16_t lo, hi, mid, t;
+
+    lo = vreinterpretq_u8_p128(vmull_p64(a0, b0));
+    hi = vreinterpretq_u8_p128(vmull_high_p64(pa, pb));
+    mid = veorq_u8(vreinterpretq_u8_p128(vmull_p64(a0, b1)), vreinterpretq_u8_p128(vmull_p64(a1, b0)));
+    lo = veorq_u8(lo, vextq_u8(zero, mid, 8));
+    hi = veorq_u8(hi, vextq_u8(mid, zero, 8));
+
+    // Bits 192..255 land on 64..134; the overflow past 127 goes back into hi's low half
+    t = vreinterpretq_u8_p128(vmull_p64(vgetq_lane_p64(vreinterpretq_p64_u8(hi), 1), 0x87));
+    hi = veorq_u8(hi, vextq_u8(t, zero, 8));
+    lo = veorq_u8(lo, vextq_u8(zero, t, 8));
+    t = vreinterpretq_u8_p128(vmull_p64(vgetq_lane_p64(vreinterpretq_p64_u8(hi), 0), 0x87));
+    return veorq_u8(lo, t);
+}
+
+static void ce_ghash(const u8 *h, u8 *x, const u8 *src, unsigned int nblocks) {
+    uint8x16_t hk = vrbitq_u8(vld1q_u8(h));
+    uint8x16_t acc = vrbitq_u8(vld1q_u8(x));
+
+    for (; nblocks; nblocks--, src += AES_BLOCK_SIZE)
+        acc = ce_gfmul(veorq_u8(acc, vrbitq_u8(vld1q_u8(src))), hk);
+
+    vst1q_u8(x, vrbitq_u8(acc));
+}
+
+static bool ce_usable(void) {
+    // Round keys are loaded as bytes, which matches key_enc[] on little-endian only
+    return !IS_ENABLED(CONFIG_CPU_BIG_ENDIAN) && cpu_have_named_feature(AES);
+}
+
+static bool ce_has_clmul(void) {
+    return cpu_have_named_feature(PMULL);
+}
+
+static void ce_begin(void) {
+    kernel_neon_begin();
+}
+
+static void ce_end(void) {
+    kernel_neon_end();
+}
+
+// One copy of the cipher entry points per key size, each with its round count built in
+#define CE_SIZED(rounds)                                                                               \
+    static void ce_encrypt_##rounds(const struct aes_ctx *ctx, u8 *dst, const u8 *src,                \
+                                    unsigned int nblocks) {                                           \
+        ce_encrypt(ctx, rounds, dst, src, nblocks);                                                   \
+    }                                                                                                 \
+                                                                                                      \
+    static void ce_decrypt_##rounds(const struct aes_ctx *ctx, u8 *dst, const u8 *src,                \
+                                    unsigned int nblocks) {                                           \
+        ce_decrypt(ctx, rounds, dst, src, nblocks);                                                   \
+    }                                                                                                 \
+                                                                                                      \
+    static void ce_cbc_encrypt_##rounds(const struct aes_ctx *ctx, u8 *iv, u8 *dst, const u8 *src,    \
+                                        unsigned int nblocks) {                                       \
+        ce_cbc_encrypt(ctx, rounds, iv, dst, src, nblocks);                                           \
+    }                                                                                                 \
+                                                                                                      \
+    static void ce_ctr_crypt_##rounds(const struct aes_ctx *ctx, u8 *ctr, u8 *dst, const u8 *src,     \
+                                      unsigned int nblocks) {                                         \
+        ce_ctr_crypt(ctx, rounds, ctr, dst, src, nblocks);                                            \
+    }                                                                                                 \
+                                                                                                      \
+    static const struct aes_impl aes_impl_ce_##rounds = {                                             \
+        .name        = "ce",                                                                          \
+        .encrypt     = ce_encrypt_##rounds,                                                           \
+        .decrypt     = ce_decrypt_##rounds,                                                           \
+        .cbc_encrypt = ce_cbc_encrypt_##rounds,                                                       \
+        .ctr_crypt   = ce_ctr_crypt_##rounds,                                                         \
+        .ghash       = ce_ghash,                                                                      \
+        .begin       = ce_begin,                                                                      \
+        .end         = ce_end,                                                                        \
+    };
+
+CE_SIZED(10)
+CE_SIZED(12)
+CE_SIZED(14)
+
+const struct aes_impl aes_impl_ce = {
+    .name      = "ce",
+    .usable    = ce_usable,
+    .has_clmul = ce_has_clmul,
+    .sized     = { &aes_impl_ce_10, &aes_impl_ce_12, &aes_impl_ce_14 },
+};
@@ -0,0 +1,234 @@
+#ifndef _AES_CORE_H
+#define _AES_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/cache.h>
+#else
+#include "aes_user.h"  // the userspace benchmark build
+#endif
+
+#define AES_BLOCK_SIZE 16
+#define AES_MIN_KEY_SIZE 16
+#define AES_MAX_KEY_SIZE 32
+#define AES_MAX_ROUNDS 14
+#define AES_MAX_KEYLENGTH_U32 (4 * (AES_MAX_ROUNDS + 1))
+#define AES_KEY_SIZES 3  // 128, 192 and 256 bits: 10, 12 and 14 rounds
+
+/*
+ * Expanded key schedule. Round key words are kept in little-endian column
+ * order, i.e. the in-memory bytes of key_enc[] are the FIPS-197 round keys.
+ * key_dec[] holds the "equivalent inverse cipher" schedule (InvMixColumns
+ * already applied to the middle rounds). Contexts start on a cache line so
+ * the round keys of a block touch as few lines as possible.
+ */
+struct aes_ctx {
+    u32 key_enc[AES_MAX_KEYLENGTH_U32];
+    u32 key_dec[AES_MAX_KEYLENGTH_U32];
+    unsigned int rounds;
+    unsigned int key_len;
+    const struct aes_impl *impl;  // backend picked when the key was set
+    u64 key_bs[8 * (AES_MAX_ROUNDS + 1)];  // bitsliced round keys, aes_bs.c only
+} ____cacheline_aligned;
+
+/*
+ * A block cipher backend. encrypt/decrypt run independent blocks (ECB) and
+ * should interleave several of them to keep the AES units busy. cbc_encrypt
+ * and ctr_crypt are optional, for backends that can keep the chain in a
+ * register or XOR the keystream without a round trip to memory. setkey
+ * converts the expanded schedule to a private layout, if any. ghash is a
+ * carry-less multiply GHASH, only called when aes_have_clmul is set, and so
+ * is gcm_crypt, which runs GCM's CTR keystream and the GHASH of the
+ * ciphertext in one pass over whole blocks. begin/end bracket any use of
+ * SIMD registers and are NULL for the portable code.
+ *
+ * sized[] holds copies of the backend built for one round count each, so
+ * their round loops are unrolled and nothing is tested per block;
+ * aes_set_key() gives a context the copy for its key size, and the
+ * top-level entry then only needs name, usable and has_clmul. Backends that
+ * leave it empty read ctx->rounds.
+ */
+struct aes_impl {
+    const char *name;
+    bool (*usable)(void);
+    bool (*has_clmul)(void);
+    void (*setkey)(struct aes_ctx *ctx);
+    void (*encrypt)(const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int nblocks);
+    void (*decrypt)(const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int nblocks);
+    void (*cbc_encrypt)(const struct aes_ctx *ctx, u8 *iv, u8 *dst, const u8 *src, unsigned int nblocks);
+    void (*ctr_crypt)(const struct aes_ctx *ctx, u8 *ctr, u8 *dst, const u8 *src, unsigned int nblocks);
+    void (*ghash)(const u8 *h, u8 *x, const u8 *src, unsigned int nblocks);
+    void (*gcm_crypt)(const struct aes_ctx *ctx, const u8 *h, u8 *x, u8 *ctr, u8 *dst, const u8 *src,
+                      unsigned int nblocks, bool enc);
+    void (*begin)(void);
+    void (*end)(void);
+    const struct aes_impl *sized[AES_KEY_SIZES];
+};
+
+// sized[] index for a round count
+#define AES_SIZED(rounds) (((rounds) - 10) / 2)
+
+extern const struct aes_impl aes_impl_generic;
+extern const struct aes_impl aes_impl_bitslice;
+extern const struct aes_impl aes_impl_aesni;  // aes_ni.c, x86-64 only
+extern const struct aes_impl aes_impl_ce;     // aes_ce.c, arm64 only
+
+// Set at load when the CPU has a carry-less multiply (PCLMULQDQ / PMULL)
+extern bool aes_have_clmul;
+
+/**
+ * aes_core_init - Picks the block cipher backend for keys set from now on.
+ * @name: A backend name, or NULL/"auto" for the fastest one the CPU supports.
+ *
+ * Returns:
+ *   0 on success, -ENODEV if the requested backend is not usable here.
+ */
+int aes_core_init(const char *name);
+const char *aes_core_impl_name(void);
+
+/*
+ * SIMD backends need the FPU/NEON state saved around their use and keep
+ * preemption off while they hold it, so bulk work is cut into chunks.
+ */
+#define AES_SIMD_CHUNK_BLOCKS 256
+
+static inline void aes_begin(const struct aes_impl *impl) {
+    if (impl->begin)
+        impl->begin();
+}
+
+static inline void aes_end(const struct aes_impl *impl) {
+    if (impl->end)
+        impl->end();
+}
+
+// dst = a ^ b, a word at a time; any alignment, dst may alias a or b
+static inline void aes_xor(u8 *dst, const u8 *a, const u8 *b, unsigned int len) {
+    for (; len >= sizeof(u64); len -= sizeof(u64)) {
+        u64 x, y;
+
+        memcpy(&x, a, sizeof(x));
+        memcpy(&y, b, sizeof(y));
+        x ^= y;
+        memcpy(dst, &x, sizeof(x));
+        dst += sizeof(u64);
+        a += sizeof(u64);
+        b += sizeof(u64);
+    }
+    while (len--)
+        *dst++ = *a++ ^ *b++;
+}
+
+/**
+ * aes_set_key - Expands a 128, 192 or 256-bit key into @ctx.
+ * @ctx: The context to fill.
+ * @key: The raw key bytes.
+ * @key_len: 16, 24 or 32.
+ *
+ * Returns:
+ *   0 on success, -EINVAL for an unsupported key length.
+ */
+int aes_set_key(struct aes_ctx *ctx, const u8 *key, unsigned int key_len);
+
+// ECB primitives, @dst and @src may alias
+void aes_encrypt_blocks(const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int nblocks);
+void aes_decrypt_blocks(const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int nblocks);
+
+// CBC, @iv is updated so consecutive calls chain
+void aes_cbc_encrypt(const struct aes_ctx *ctx, u8 *iv, u8 *dst, const u8 *src, unsigned int nblocks);
+void aes_cbc_decrypt(const struct aes_ctx *ctx, u8 *iv, u8 *dst, const u8 *src, unsigned int nblocks);
+
+/*
+ * CTR, @ctr is a 128-bit big-endian counter advanced once per block. Any
+ * @len works; a partial last block still uses up a counter value, so callers
+ * streaming data should pass whole blocks until the end.
+ */
+void aes_ctr_crypt(const struct aes_ctx *ctx, u8 *ctr, u8 *dst, const u8 *src, unsigned int len);
+
+// Big-endian 64-bit halves of a counter block, one load or store each
+static __always_inline u64 aes_load_be64(const u8 *p) {
+    u64 v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static __always_inline void aes_store_be64(u8 *p, u64 v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    memcpy(p, &v, sizeof(v));
+}
+
+// Writes @nblocks consecutive counter blocks starting at @ctr and advances it
+static __always_inline void aes_ctr_fill(u8 *out, u8 *ctr, unsigned int nblocks) {
+    u64 hi = aes_load_be64(ctr), lo = aes_load_be64(ctr + 8);
+
+    for (; nblocks; nblocks--, out += AES_BLOCK_SIZE) {
+        aes_store_be64(out, hi);
+        aes_store_be64(out + 8, lo);
+        if (!++lo)
+            hi++;
+    }
+
+    aes_store_be64(ctr, hi);
+    aes_store_be64(ctr + 8, lo);
+}
+
+// Whole-block CTR for callers already between aes_begin()/aes_end()
+void aes_ctr_blocks(const struct aes_ctx *ctx, u8 *ctr, u8 *dst, const u8 *src, unsigned int nblocks);
+
+/*
+ * XTS (IEEE 1619) over whole data units. The two halves of the key go to
+ * separate contexts: crypt for the data, tweak for the sector number.
+ */
+struct aes_xts_ctx {
+    struct aes_ctx crypt;
+    struct aes_ctx tweak;
+};
+
+int aes_xts_set_key(struct aes_xts_ctx *ctx, const u8 *key, unsigned int key_len);
+
+/*
+ * @nunits units of @unit_size bytes (a multiple of the block size). @sector
+ * is the 16-byte little-endian number of the first unit and is advanced
+ * past the last one.
+ */
+void aes_xts_encrypt(const struct aes_xts_ctx *ctx, u8 *sector, u8 *dst, const u8 *src,
+                     unsigned int nunits, unsigned int unit_size);
+void aes_xts_decrypt(const struct aes_xts_ctx *ctx, u8 *sector, u8 *dst, const u8 *src,
+                     unsigned int nunits, unsigned int unit_size);
+
+#define AES_GCM_IV_SIZE 12
+#define AES_GCM_TAG_SIZE 16
+
+/*
+ * GCM stream state. Only 96-bit IVs are taken, so the counter is IV || ctr32
+ * and the 32-bit part cannot wrap within the GCM length limit.
+ */
+struct aes_gcm_ctx {
+    u64 hh[16], hl[16];        // 4-bit GHASH table, multiples of H
+    u8 h[AES_BLOCK_SIZE];      // hash key E_K(0^128)
+    u8 j0[AES_BLOCK_SIZE];     // pre-counter block, masks the tag
+    u8 ctr[AES_BLOCK_SIZE];
+    u8 x[AES_BLOCK_SIZE];      // running GHASH
+    u64 aad_len, text_len;     // bytes
+    bool aad_done, text_done;  // a partial block closes its section
+};
+
+int aes_gcm_init(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, const u8 *iv, unsigned int iv_len);
+
+// AAD goes in before any text; only the last call may have a partial block
+int aes_gcm_aad(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, const u8 *aad, unsigned int len);
+
+// Same rule for text: every call but the last must be whole blocks
+int aes_gcm_encrypt(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int len);
+int aes_gcm_decrypt(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int len);
+
+void aes_gcm_final(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, u8 *tag);
+
+#endif /* _AES_CORE_H */
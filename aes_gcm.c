@@ -0,0 +1,236 @@
+/*
+ * AES-GCM (NIST SP 800-38D) on top of the CTR primitives.
+ *
+ * Text is processed a chunk at a time: the keystream is XORed in and the
+ * ciphertext hashed while it is still in L1. GHASH uses the backend's
+ * carry-less multiply when the CPU has one, fused with the keystream if the
+ * backend can, and Shoup's 4-bit table otherwise.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#endif
+
+#include "aes_core.h"
+
+// Plaintext limit from SP 800-38D, 2^39 - 256 bits; keeps ctr32 from wrapping
+#define AES_GCM_MAX_TEXT ((1ULL << 36) - 32)
+
+// Reduction constants for the four bits shifted out per table step
+static const u64 gcm_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+static inline u64 load_be64(const u8 *p) {
+    return ((u64)p[0] << 56) | ((u64)p[1] << 48) | ((u64)p[2] << 40) | ((u64)p[3] << 32) |
+           ((u64)p[4] << 24) | ((u64)p[5] << 16) | ((u64)p[6] << 8) | p[7];
+}
+
+static inline void store_be64(u8 *p, u64 v) {
+    int i;
+
+    for (i = 7; i >= 0; i--, v >>= 8)
+        p[i] = (u8)v;
+}
+
+// hh/hl[i] = i * H, with i read as a 4-bit polynomial in GCM bit order
+static void gcm_gen_table(struct aes_gcm_ctx *gcm) {
+    u64 vh = load_be64(gcm->h), vl = load_be64(gcm->h + 8);
+    int i, j;
+
+    gcm->hh[0] = gcm->hl[0] = 0;
+    gcm->hh[8] = vh;
+    gcm->hl[8] = vl;
+
+    for (i = 4; i > 0; i >>= 1) {
+        u64 t = (vl & 1) * 0xe100000000000000ULL;
+
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ t;
+        gcm->hh[i] = vh;
+        gcm->hl[i] = vl;
+    }
+
+    for (i = 2; i <= 8; i <<= 1) {
+        for (j = 1; j < i; j++) {
+            gcm->hh[i + j] = gcm->hh[i] ^ gcm->hh[j];
+            gcm->hl[i + j] = gcm->hl[i] ^ gcm->hl[j];
+        }
+    }
+}
+
+// x = x * H, a nibble at a time from the last byte
+static void gcm_mult(const struct aes_gcm_ctx *gcm, u8 *x) {
+    unsigned int lo = x[15] & 0xf, hi, rem;
+    u64 zh = gcm->hh[lo], zl = gcm->hl[lo];
+    int i;
+
+    for (i = 15; i >= 0; i--) {
+        lo = x[i] & 0xf;
+        hi = x[i] >> 4;
+
+        if (i != 15) {
+            rem = zl & 0xf;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (gcm_last4[rem] << 48) ^ gcm->hh[lo];
+            zl ^= gcm->hl[lo];
+        }
+
+        rem = zl & 0xf;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (gcm_last4[rem] << 48) ^ gcm->hh[hi];
+        zl ^= gcm->hl[hi];
+    }
+
+    store_be64(x, zh);
+    store_be64(x + 8, zl);
+}
+
+// Must run between aes_begin()/aes_end(), the clmul path uses SIMD registers
+static void gcm_ghash(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, const u8 *src, unsigned int nblocks) {
+    if (aes_have_clmul && ctx->impl->ghash) {
+        ctx->impl->ghash(gcm->h, gcm->x, src, nblocks);
+        return;
+    }
+
+    for (; nblocks; nblocks--, src += AES_BLOCK_SIZE) {
+        aes_xor(gcm->x, gcm->x, src, AES_BLOCK_SIZE);
+        gcm_mult(gcm, gcm->x);
+    }
+}
+
+// Hashes a short last block as if zero padded
+static void gcm_ghash_tail(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, const u8 *src, unsigned int len) {
+    u8 block[AES_BLOCK_SIZE] = { 0 };
+
+    memcpy(block, src, len);
+    aes_begin(ctx->impl);
+    gcm_ghash(gcm, ctx, block, 1);
+    aes_end(ctx->impl);
+}
+
+/**
+ * aes_gcm_init - Starts a GCM message under the key in @ctx.
+ * @gcm: The state to reset.
+ * @ctx: An expanded key; it must stay the same for the whole message.
+ * @iv: The nonce.
+ * @iv_len: Must be AES_GCM_IV_SIZE.
+ *
+ * Returns:
+ *   0 on success, -EINVAL for any other IV length.
+ */
+int aes_gcm_init(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, const u8 *iv, unsigned int iv_len) {
+    if (iv_len != AES_GCM_IV_SIZE)
+        return -EINVAL;
+
+    memset(gcm, 0, sizeof(*gcm));
+    aes_encrypt_blocks(ctx, gcm->h, gcm->h, 1);
+    gcm_gen_table(gcm);
+
+    // J0 = IV || 1; text starts at inc32(J0)
+    memcpy(gcm->j0, iv, AES_GCM_IV_SIZE);
+    gcm->j0[15] = 1;
+    memcpy(gcm->ctr, gcm->j0, AES_BLOCK_SIZE);
+    gcm->ctr[15] = 2;
+    return 0;
+}
+
+int aes_gcm_aad(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, const u8 *aad, unsigned int len) {
+    unsigned int nblocks = len / AES_BLOCK_SIZE;
+    unsigned int tail = len % AES_BLOCK_SIZE;
+
+    if (gcm->aad_done || gcm->text_len)
+        return -EINVAL;
+
+    if (nblocks) {
+        aes_begin(ctx->impl);
+        gcm_ghash(gcm, ctx, aad, nblocks);
+        aes_end(ctx->impl);
+    }
+
+    if (tail) {
+        gcm_ghash_tail(gcm, ctx, aad + nblocks * AES_BLOCK_SIZE, tail);
+        gcm->aad_done = true;
+    }
+
+    gcm->aad_len += len;
+    return 0;
+}
+
+static int gcm_crypt(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int len, bool enc) {
+    const struct aes_impl *impl = ctx->impl;
+    unsigned int nblocks = len / AES_BLOCK_SIZE;
+    unsigned int tail = len % AES_BLOCK_SIZE;
+
+    if (gcm->text_done || len > AES_GCM_MAX_TEXT - gcm->text_len)
+        return -EINVAL;
+
+    gcm->aad_done = true;
+    gcm->text_len += len;
+
+    while (nblocks) {
+        unsigned int n = min_t(unsigned int, nblocks, AES_SIMD_CHUNK_BLOCKS);
+
+        aes_begin(impl);
+        if (aes_have_clmul && impl->gcm_crypt) {
+            impl->gcm_crypt(ctx, gcm->h, gcm->x, gcm->ctr, dst, src, n, enc);
+        } else {
+            // GHASH always covers the ciphertext, so decryption hashes before an in-place overwrite
+            if (!enc)
+                gcm_ghash(gcm, ctx, src, n);
+            aes_ctr_blocks(ctx, gcm->ctr, dst, src, n);
+            if (enc)
+                gcm_ghash(gcm, ctx, dst, n);
+        }
+        aes_end(impl);
+        src += n * AES_BLOCK_SIZE;
+        dst += n * AES_BLOCK_SIZE;
+        nblocks -= n;
+    }
+
+    if (tail) {
+        u8 ct[AES_BLOCK_SIZE];
+
+        if (!enc)
+            memcpy(ct, src, tail);
+        aes_ctr_crypt(ctx, gcm->ctr, dst, src, tail);
+        if (enc)
+            memcpy(ct, dst, tail);
+        gcm_ghash_tail(gcm, ctx, ct, tail);
+        gcm->text_done = true;
+    }
+
+    return 0;
+}
+
+int aes_gcm_encrypt(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int len) {
+    return gcm_crypt(gcm, ctx, dst, src, len, true);
+}
+
+int aes_gcm_decrypt(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, u8 *dst, const u8 *src, unsigned int len) {
+    return gcm_crypt(gcm, ctx, dst, src, len, false);
+}
+
+/**
+ * aes_gcm_final - Closes the message and computes its tag.
+ * @gcm: The message state; no more AAD or text may follow.
+ * @ctx: The key the message was started with.
+ * @tag: Receives AES_GCM_TAG_SIZE bytes.
+ *
+ * Decryption compares @tag against the received one with crypto_memneq().
+ */
+void aes_gcm_final(struct aes_gcm_ctx *gcm, const struct aes_ctx *ctx, u8 *tag) {
+    u8 lens[AES_BLOCK_SIZE];
+
+    store_be64(lens, gcm->aad_len * 8);
+    store_be64(lens + 8, gcm->text_len * 8);
+    aes_begin(ctx->impl);
+    gcm_ghash(gcm, ctx, lens, 1);
+    aes_end(ctx->impl);
+
+    aes_encrypt_blocks(ctx, tag, gcm->j0, 1);
+    aes_xor(tag, tag, gcm->x, AES_GCM_TAG_SIZE);
+    gcm->aad_done = gcm->text_done = true;
+}
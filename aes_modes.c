@@ -0,0 +1,243 @@
+/*
+ * Block cipher modes on top of the aes_impl backends.
+ *
+ * Whenever the mode allows it, blocks are handed to the backend in batches
+ * so that its interleaved (AES-NI, CE) or bitsliced paths get full width.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#endif
+
+#include "aes_core.h"
+
+// Counter blocks encrypted per backend call in the generic CTR path
+#define AES_CTR_BATCH 8
+
+// Ciphertext blocks decrypted per backend call in CBC decryption
+#define AES_CBC_BATCH 8
+
+// Tweaked blocks per backend call in XTS
+#define AES_XTS_BATCH 8
+
+void aes_cbc_encrypt(const struct aes_ctx *ctx, u8 *iv, u8 *dst, const u8 *src, unsigned int nblocks) {
+    const struct aes_impl *impl = ctx->impl;
+    unsigned int i, j;
+
+    while (nblocks) {
+        unsigned int n = min_t(unsigned int, nblocks, AES_SIMD_CHUNK_BLOCKS);
+
+        aes_begin(impl);
+        if (impl->cbc_encrypt) {
+            impl->cbc_encrypt(ctx, iv, dst, src, n);
+        } else {
+            for (i = 0; i < n; i++) {
+                for (j = 0; j < AES_BLOCK_SIZE; j++)
+                    iv[j] ^= src[i * AES_BLOCK_SIZE + j];
+                impl->encrypt(ctx, iv, iv, 1);
+                memcpy(dst + i * AES_BLOCK_SIZE, iv, AES_BLOCK_SIZE);
+            }
+        }
+        aes_end(impl);
+        dst += n * AES_BLOCK_SIZE;
+        src += n * AES_BLOCK_SIZE;
+        nblocks -= n;
+    }
+}
+
+void aes_cbc_decrypt(const struct aes_ctx *ctx, u8 *iv, u8 *dst, const u8 *src, unsigned int nblocks) {
+    const struct aes_impl *impl = ctx->impl;
+    u8 ct[AES_CBC_BATCH * AES_BLOCK_SIZE];
+    u8 pt[AES_CBC_BATCH * AES_BLOCK_SIZE];
+
+    while (nblocks) {
+        unsigned int n = min_t(unsigned int, nblocks, AES_SIMD_CHUNK_BLOCKS);
+        unsigned int done, batch, len;
+
+        aes_begin(impl);
+        for (done = 0; done < n; done += batch) {
+            batch = min_t(unsigned int, n - done, AES_CBC_BATCH);
+            len = batch * AES_BLOCK_SIZE;
+
+            /*
+             * No chaining on this side: decrypt the whole batch in one
+             * backend call, then XOR each block with the ciphertext before
+             * it. The ciphertext is saved first since dst may overwrite it.
+             */
+            memcpy(ct, src, len);
+            impl->decrypt(ctx, pt, ct, batch);
+            aes_xor(dst, pt, iv, AES_BLOCK_SIZE);
+            aes_xor(dst + AES_BLOCK_SIZE, pt + AES_BLOCK_SIZE, ct, len - AES_BLOCK_SIZE);
+            memcpy(iv, ct + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+            dst += len;
+            src += len;
+        }
+        aes_end(impl);
+        nblocks -= n;
+    }
+}
+
+void aes_ctr_blocks(const struct aes_ctx *ctx, u8 *ctr, u8 *dst, const u8 *src, unsigned int nblocks) {
+    const struct aes_impl *impl = ctx->impl;
+    u8 ks[AES_CTR_BATCH * AES_BLOCK_SIZE];
+    unsigned int done, batch;
+
+    if (impl->ctr_crypt) {
+        impl->ctr_crypt(ctx, ctr, dst, src, nblocks);
+        return;
+    }
+
+    // Keystream for a whole batch of counters per call keeps the pipeline full
+    for (done = 0; done < nblocks; done += batch) {
+        batch = min_t(unsigned int, nblocks - done, AES_CTR_BATCH);
+        aes_ctr_fill(ks, ctr, batch);
+        impl->encrypt(ctx, ks, ks, batch);
+        aes_xor(dst + done * AES_BLOCK_SIZE, src + done * AES_BLOCK_SIZE, ks, batch * AES_BLOCK_SIZE);
+    }
+}
+
+void aes_ctr_crypt(const struct aes_ctx *ctx, u8 *ctr, u8 *dst, const u8 *src, unsigned int len) {
+    const struct aes_impl *impl = ctx->impl;
+    u8 ks[AES_BLOCK_SIZE];
+    unsigned int nblocks = len / AES_BLOCK_SIZE;
+    unsigned int tail = len % AES_BLOCK_SIZE;
+
+    while (nblocks) {
+        unsigned int n = min_t(unsigned int, nblocks, AES_SIMD_CHUNK_BLOCKS);
+
+        aes_begin(impl);
+        aes_ctr_blocks(ctx, ctr, dst, src, n);
+        aes_end(impl);
+        dst += n * AES_BLOCK_SIZE;
+        src += n * AES_BLOCK_SIZE;
+        nblocks -= n;
+    }
+
+    // A partial last block still consumes a whole counter value
+    if (tail) {
+        aes_ctr_fill(ks, ctr, 1);
+        aes_encrypt_blocks(ctx, ks, ks, 1);
+        aes_xor(dst, src, ks, tail);
+    }
+}
+
+static inline u64 load_le64(const u8 *p) {
+    return ((u64)p[7] << 56) | ((u64)p[6] << 48) | ((u64)p[5] << 40) | ((u64)p[4] << 32) |
+           ((u64)p[3] << 24) | ((u64)p[2] << 16) | ((u64)p[1] << 8) | (u64)p[0];
+}
+
+static inline void store_le64(u8 *p, u64 v) {
+    int i;
+
+    for (i = 0; i < 8; i++, v >>= 8)
+        p[i] = (u8)v;
+}
+
+/**
+ * aes_xts_set_key - Expands an XTS key: data key first, tweak key second.
+ * @ctx: The pair of contexts to fill.
+ * @key: The concatenated keys.
+ * @key_len: 32, 48 or 64.
+ *
+ * Returns:
+ *   0 on success, -EINVAL for a bad length or two identical halves.
+ */
+int aes_xts_set_key(struct aes_xts_ctx *ctx, const u8 *key, unsigned int key_len) {
+    unsigned int half = key_len / 2;
+    int ret;
+
+    if (key_len & 1)
+        return -EINVAL;
+
+    // Equal halves degrade XTS to ECB-like behaviour on the first block (IEEE 1619 5.1)
+    if (!memcmp(key, key + half, half))
+        return -EINVAL;
+
+    ret = aes_set_key(&ctx->crypt, key, half);
+    if (ret < 0)
+        return ret;
+    return aes_set_key(&ctx->tweak, key + half, half);
+}
+
+/*
+ * One data unit. The tweaks of a batch are stepped by x in GF(2^128) up
+ * front, so the backend sees AES_XTS_BATCH independent blocks per call.
+ */
+static void xts_unit(const struct aes_xts_ctx *ctx, const u8 *sector, u8 *dst, const u8 *src,
+                     unsigned int nblocks, bool enc) {
+    const struct aes_impl *impl = ctx->crypt.impl;
+    u8 tw[AES_XTS_BATCH * AES_BLOCK_SIZE];
+    u8 buf[AES_XTS_BATCH * AES_BLOCK_SIZE];
+    unsigned int done, batch, len, i;
+    u64 lo, hi;
+
+    ctx->tweak.impl->encrypt(&ctx->tweak, tw, sector, 1);
+    lo = load_le64(tw);
+    hi = load_le64(tw + 8);
+
+    for (done = 0; done < nblocks; done += batch) {
+        batch = min_t(unsigned int, nblocks - done, AES_XTS_BATCH);
+        len = batch * AES_BLOCK_SIZE;
+
+        for (i = 0; i < batch; i++) {
+            u64 carry = hi >> 63;
+
+            store_le64(tw + i * AES_BLOCK_SIZE, lo);
+            store_le64(tw + i * AES_BLOCK_SIZE + 8, hi);
+            hi = (hi << 1) | (lo >> 63);
+            lo = (lo << 1) ^ (carry * 0x87);
+        }
+
+        aes_xor(buf, src, tw, len);
+        if (enc)
+            impl->encrypt(&ctx->crypt, buf, buf, batch);
+        else
+            impl->decrypt(&ctx->crypt, buf, buf, batch);
+        aes_xor(dst, buf, tw, len);
+
+        dst += len;
+        src += len;
+    }
+}
+
+// The sector number is a 128-bit little-endian integer, as in dm-crypt's plain64
+static inline void xts_next_sector(u8 *sector) {
+    u64 lo = load_le64(sector), hi = load_le64(sector + 8);
+
+    if (!++lo)
+        hi++;
+    store_le64(sector, lo);
+    store_le64(sector + 8, hi);
+}
+
+static void xts_crypt(const struct aes_xts_ctx *ctx, u8 *sector, u8 *dst, const u8 *src,
+                      unsigned int nunits, unsigned int unit_size, bool enc) {
+    const struct aes_impl *impl = ctx->crypt.impl;
+    unsigned int per_chunk = max_t(unsigned int, AES_SIMD_CHUNK_BLOCKS * AES_BLOCK_SIZE / unit_size, 1);
+
+    while (nunits) {
+        unsigned int n = min_t(unsigned int, nunits, per_chunk), i;
+
+        aes_begin(impl);
+        for (i = 0; i < n; i++) {
+            xts_unit(ctx, sector, dst, src, unit_size / AES_BLOCK_SIZE, enc);
+            xts_next_sector(sector);
+            dst += unit_size;
+            src += unit_size;
+        }
+        aes_end(impl);
+        nunits -= n;
+    }
+}
+
+void aes_xts_encrypt(const struct aes_xts_ctx *ctx, u8 *sector, u8 *dst, const u8 *src,
+                     unsigned int nunits, unsigned int unit_size) {
+    xts_crypt(ctx, sector, dst, src, nunits, unit_size, true);
+}
+
+void aes_xts_decrypt(const struct aes_xts_ctx *ctx, u8 *sector, u8 *dst, const u8 *src,
+                     unsigned int nunits, unsigned int unit_size) {
+    xts_crypt(ctx, sector, dst, src, nunits, unit_size, false);
+}
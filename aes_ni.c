@@ -0,0 +1,471 @@
+/*
+ * AES-NI backend (x86-64).
+ *
+ * Uses the compiler's vector builtins rather than <wmmintrin.h>, which
+ * drags in userspace headers. The Makefile enables SSE/AES/PCLMUL for this
+ * file only; everything here runs between kernel_fpu_begin()/kernel_fpu_end().
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+
+#include "aes_core.h"
+
+typedef long long v2di __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+typedef char v16qi __attribute__((vector_size(16)));
+
+static __always_inline v2di load128(const u8 *p) {
+    v2di v;
+
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static __always_inline void store128(u8 *p, v2di v) {
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
+// One AES round on eight independent blocks, so the AES unit pipeline stays full
+#define AESNI_ROUND8(op, k) do {        \
+        b0 = op(b0, k); b1 = op(b1, k); \
+        b2 = op(b2, k); b3 = op(b3, k); \
+        b4 = op(b4, k); b5 = op(b5, k); \
+        b6 = op(b6, k); b7 = op(b7, k); \
+    } while (0)
+
+#define AESNI_LOAD8(src, k) do {                                   \
+        b0 = load128(src) ^ k;        b1 = load128(src + 16) ^ k;  \
+        b2 = load128(src + 32) ^ k;   b3 = load128(src + 48) ^ k;  \
+        b4 = load128(src + 64) ^ k;   b5 = load128(src + 80) ^ k;  \
+        b6 = load128(src + 96) ^ k;   b7 = load128(src + 112) ^ k; \
+    } while (0)
+
+#define AESNI_XOR8(src) do {                               \
+        b0 ^= load128(src);      b1 ^= load128(src + 16);  \
+        b2 ^= load128(src + 32); b3 ^= load128(src + 48);  \
+        b4 ^= load128(src + 64); b5 ^= load128(src + 80);  \
+        b6 ^= load128(src + 96); b7 ^= load128(src + 112); \
+    } while (0)
+
+#define AESNI_STORE8(dst) do {                           \
+        store128(dst, b0);      store128(dst + 16, b1);  \
+        store128(dst + 32, b2); store128(dst + 48, b3);  \
+        store128(dst + 64, b4); store128(dst + 80, b5);  \
+        store128(dst + 96, b6); store128(dst + 112, b7); \
+    } while (0)
+
+/*
+ * Rounds 1 to rounds - 1, written out. @rounds is a constant wherever this
+ * is expanded, so the key size tests fold away and no loop is left.
+ */
+#define AESNI_MIDDLE(ROUND, rounds) do {                                 \
+        ROUND(k[1]); ROUND(k[2]); ROUND(k[3]); ROUND(k[4]); ROUND(k[5]); \
+        ROUND(k[6]); ROUND(k[7]); ROUND(k[8]); ROUND(k[9]);              \
+        if ((rounds) > 10) {                                             \
+            ROUND(k[10]); ROUND(k[11]);                                  \
+        }                                                                \
+        if ((rounds) > 12) {                                             \
+            ROUND(k[12]); ROUND(k[13]);                                  \
+        }                                                                \
+    } while (0)
+
+#define AESNI_ENC8(key) AESNI_ROUND8(__builtin_ia32_aesenc128, key)
+#define AESNI_DEC8(key) AESNI_ROUND8(__builtin_ia32_aesdec128, key)
+#define AESNI_ENC1(key) (b0 = __builtin_ia32_aesenc128(b0, key))
+#define AESNI_DEC1(key) (b0 = __builtin_ia32_aesdec128(b0, key))
+
+static __always_inline void aesni_load_keys(v2di *k, const u32 *key, unsigned int rounds) {
+    unsigned int r;
+
+    for (r = 0; r <= rounds; r++)
+        k[r] = load128((const u8 *)key + r * AES_BLOCK_SIZE);
+}
+
+static __always_inline void aesni_crypt(const u32 *key, unsigned int rounds, bool enc, u8 *dst, const u8 *src,
+                                        unsigned int nblocks) {
+    v2di k[AES_MAX_ROUNDS + 1];
+    v2di b0, b1, b2, b3, b4, b5, b6, b7;
+
+    aesni_load_keys(k, key, rounds);
+
+    for (; nblocks >= 8; nblocks -= 8) {
+        AESNI_LOAD8(src, k[0]);
+        if (enc) {
+            AESNI_MIDDLE(AESNI_ENC8, rounds);
+            AESNI_ROUND8(__builtin_ia32_aesenclast128, k[rounds]);
+        } else {
+            AESNI_MIDDLE(AESNI_DEC8, rounds);
+            AESNI_ROUND8(__builtin_ia32_aesdeclast128, k[rounds]);
+        }
+        AESNI_STORE8(dst);
+        src += 8 * AES_BLOCK_SIZE;
+        dst += 8 * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        b0 = load128(src) ^ k[0];
+        if (enc) {
+            AESNI_MIDDLE(AESNI_ENC1, rounds);
+            b0 = __builtin_ia32_aesenclast128(b0, k[rounds]);
+        } else {
+            AESNI_MIDDLE(AESNI_DEC1, rounds);
+            b0 = __builtin_ia32_aesdeclast128(b0, k[rounds]);
+        }
+        store128(dst, b0);
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+}
+
+static __always_inline void aesni_cbc_encrypt(const struct aes_ctx *ctx, unsigned int rounds, u8 *iv, u8 *dst,
+                                              const u8 *src, unsigned int nblocks) {
+    v2di k[AES_MAX_ROUNDS + 1];
+    v2di b0 = load128(iv);
+
+    aesni_load_keys(k, ctx->key_enc, rounds);
+
+    // The chain value never leaves the register between blocks
+    for (; nblocks; nblocks--) {
+        b0 ^= load128(src) ^ k[0];
+        AESNI_MIDDLE(AESNI_ENC1, rounds);
+        b0 = __builtin_ia32_aesenclast128(b0, k[rounds]);
+        store128(dst, b0);
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+
+    store128(iv, b0);
+}
+
+/*
+ * Byte reversal of a whole block. GHASH is bit-reflected, and swapping puts
+ * it in PCLMULQDQ's integer order; a CTR counter kept as a little-endian
+ * 128-bit value becomes its big-endian counter block.
+ */
+static __always_inline v2di bswap128(v2di v) {
+    const v16qi rev = { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+
+    return (v2di)__builtin_ia32_pshufb128((v16qi)v, rev);
+}
+
+// Counter block @i past hi:lo, carrying into the high half
+static __always_inline v2di aesni_ctr_block(u64 hi, u64 lo, u64 i) {
+    return bswap128((v2di){ (long long)(lo + i), (long long)(hi + (lo + i < lo)) });
+}
+
+// Advances the counter, in both its scalar and vector forms
+static __always_inline void aesni_ctr_add(v2di *c, u64 *hi, u64 *lo, u64 n) {
+    *lo += n;
+    if (likely(*lo >= n)) {
+        *c += (v2di){ (long long)n, 0 };
+    } else {
+        (*hi)++;
+        *c = (v2di){ (long long)*lo, (long long)*hi };
+    }
+}
+
+/*
+ * Eight counter blocks from c, the counter with its halves as lo, hi lanes.
+ * The common case adds 1..7 to the low lane in registers; a batch that
+ * wraps the low half builds its lanes from the scalar halves instead.
+ */
+#define AESNI_CTR8(k) do {                                                            \
+        if (likely(lo <= ~0ULL - 7)) {                                                \
+            b0 = bswap128(c) ^ k;                                                     \
+            b1 = bswap128(c + (v2di){ 1, 0 }) ^ k;                                    \
+            b2 = bswap128(c + (v2di){ 2, 0 }) ^ k;                                    \
+            b3 = bswap128(c + (v2di){ 3, 0 }) ^ k;                                    \
+            b4 = bswap128(c + (v2di){ 4, 0 }) ^ k;                                    \
+            b5 = bswap128(c + (v2di){ 5, 0 }) ^ k;                                    \
+            b6 = bswap128(c + (v2di){ 6, 0 }) ^ k;                                    \
+            b7 = bswap128(c + (v2di){ 7, 0 }) ^ k;                                    \
+        } else {                                                                      \
+            b0 = aesni_ctr_block(hi, lo, 0) ^ k; b1 = aesni_ctr_block(hi, lo, 1) ^ k; \
+            b2 = aesni_ctr_block(hi, lo, 2) ^ k; b3 = aesni_ctr_block(hi, lo, 3) ^ k; \
+            b4 = aesni_ctr_block(hi, lo, 4) ^ k; b5 = aesni_ctr_block(hi, lo, 5) ^ k; \
+            b6 = aesni_ctr_block(hi, lo, 6) ^ k; b7 = aesni_ctr_block(hi, lo, 7) ^ k; \
+        }                                                                             \
+        aesni_ctr_add(&c, &hi, &lo, 8);                                               \
+    } while (0)
+
+static __always_inline void aesni_ctr_crypt(const struct aes_ctx *ctx, unsigned int rounds, u8 *ctr, u8 *dst,
+                                            const u8 *src, unsigned int nblocks) {
+    v2di k[AES_MAX_ROUNDS + 1];
+    v2di b0, b1, b2, b3, b4, b5, b6, b7;
+    u64 hi = aes_load_be64(ctr), lo = aes_load_be64(ctr + 8);
+    v2di c = { (long long)lo, (long long)hi };
+
+    aesni_load_keys(k, ctx->key_enc, rounds);
+
+    // Eight counters in flight, built and XORed with the keystream in registers
+    for (; nblocks >= 8; nblocks -= 8) {
+        AESNI_CTR8(k[0]);
+        AESNI_MIDDLE(AESNI_ENC8, rounds);
+        AESNI_ROUND8(__builtin_ia32_aesenclast128, k[rounds]);
+        AESNI_XOR8(src);
+        AESNI_STORE8(dst);
+        src += 8 * AES_BLOCK_SIZE;
+        dst += 8 * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        b0 = bswap128(c) ^ k[0];
+        aesni_ctr_add(&c, &hi, &lo, 1);
+        AESNI_MIDDLE(AESNI_ENC1, rounds);
+        b0 = __builtin_ia32_aesenclast128(b0, k[rounds]);
+        store128(dst, b0 ^ load128(src));
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+
+    aes_store_be64(ctr, hi);
+    aes_store_be64(ctr + 8, lo);
+}
+
+/*
+ * a * b in GF(2^128), from Intel's "Carry-Less Multiplication and Its Usage
+ * for Computing the GCM Mode": schoolbook product, a 1-bit left shift to
+ * undo the reflection, then reduction by x^128 + x^7 + x^2 + x + 1. The
+ * shift and reduction are linear, so a sum of products is accumulated
+ * unreduced (clmul_acc) and pays for them once (clmul_reduce).
+ */
+static __always_inline void clmul_acc(v2di a, v2di b, v2di *lo, v2di *mid, v2di *hi) {
+    *lo ^= __builtin_ia32_pclmulqdq128(a, b, 0x00);
+    *mid ^= __builtin_ia32_pclmulqdq128(a, b, 0x10) ^ __builtin_ia32_pclmulqdq128(a, b, 0x01);
+    *hi ^= __builtin_ia32_pclmulqdq128(a, b, 0x11);
+}
+
+static __always_inline v2di clmul_reduce(v2di lo, v2di mid, v2di hi) {
+    v2di t, u, w;
+
+    lo ^= __builtin_ia32_pslldqi128(mid, 64);
+    hi ^= __builtin_ia32_psrldqi128(mid, 64);
+
+    // hi:lo <<= 1
+    t = (v2di)__builtin_ia32_psrldi128((v4si)lo, 31);
+    u = (v2di)__builtin_ia32_psrldi128((v4si)hi, 31);
+    lo = (v2di)__builtin_ia32_pslldi128((v4si)lo, 1);
+    hi = (v2di)__builtin_ia32_pslldi128((v4si)hi, 1);
+    w = __builtin_ia32_psrldqi128(t, 96);
+    t = __builtin_ia32_pslldqi128(t, 32);
+    u = __builtin_ia32_pslldqi128(u, 32);
+    lo |= t;
+    hi |= u | w;
+
+    t = (v2di)(__builtin_ia32_pslldi128((v4si)lo, 31) ^ __builtin_ia32_pslldi128((v4si)lo, 30) ^
+               __builtin_ia32_pslldi128((v4si)lo, 25));
+    u = __builtin_ia32_psrldqi128(t, 32);
+    lo ^= __builtin_ia32_pslldqi128(t, 96);
+    w = (v2di)(__builtin_ia32_psrldi128((v4si)lo, 1) ^ __builtin_ia32_psrldi128((v4si)lo, 2) ^
+               __builtin_ia32_psrldi128((v4si)lo, 7));
+    return hi ^ lo ^ w ^ u;
+}
+
+static __always_inline v2di clmul_gfmul(v2di a, v2di b) {
+    v2di lo = { 0, 0 }, mid = { 0, 0 }, hi = { 0, 0 };
+
+    clmul_acc(a, b, &lo, &mid, &hi);
+    return clmul_reduce(lo, mid, hi);
+}
+
+/*
+ * Eight blocks are hashed as (x ^ c0) * H^8 ^ c1 * H^7 ^ ... ^ c7 * H: the
+ * eight multiplies are independent and share one reduction. hp[i] holds
+ * H^(i + 1).
+ */
+static __always_inline void aesni_ghash_powers(v2di *hp, const u8 *h) {
+    unsigned int i;
+
+    hp[0] = bswap128(load128(h));
+    for (i = 1; i < 8; i++)
+        hp[i] = clmul_gfmul(hp[i - 1], hp[0]);
+}
+
+// Block @i of eight at @p into the unreduced sum
+#define AESNI_GHASH_BLOCK(p, i) clmul_acc(bswap128(load128((p) + (i) * AES_BLOCK_SIZE)), hp[7 - (i)], &gl, &gm, &gh)
+
+static __always_inline v2di aesni_ghash8(v2di acc, const v2di *hp, const u8 *p) {
+    v2di gl = { 0, 0 }, gm = { 0, 0 }, gh = { 0, 0 };
+
+    clmul_acc(acc ^ bswap128(load128(p)), hp[7], &gl, &gm, &gh);
+    AESNI_GHASH_BLOCK(p, 1);
+    AESNI_GHASH_BLOCK(p, 2);
+    AESNI_GHASH_BLOCK(p, 3);
+    AESNI_GHASH_BLOCK(p, 4);
+    AESNI_GHASH_BLOCK(p, 5);
+    AESNI_GHASH_BLOCK(p, 6);
+    AESNI_GHASH_BLOCK(p, 7);
+    return clmul_reduce(gl, gm, gh);
+}
+
+static void aesni_ghash(const u8 *h, u8 *x, const u8 *src, unsigned int nblocks) {
+    v2di acc = bswap128(load128(x));
+    v2di hp[8];
+
+    // The accumulator stays byte-swapped in a register for the whole run
+    if (nblocks >= 8) {
+        aesni_ghash_powers(hp, h);
+        for (; nblocks >= 8; nblocks -= 8, src += 8 * AES_BLOCK_SIZE)
+            acc = aesni_ghash8(acc, hp, src);
+    } else {
+        hp[0] = bswap128(load128(h));
+    }
+
+    for (; nblocks; nblocks--, src += AES_BLOCK_SIZE)
+        acc = clmul_gfmul(acc ^ bswap128(load128(src)), hp[0]);
+
+    store128(x, bswap128(acc));
+}
+
+/*
+ * The middle rounds of eight counter blocks with the GHASH of eight
+ * ciphertext blocks at @p worked in between, one multiply per round, so
+ * the AES and carry-less multiply units run side by side.
+ */
+#define AESNI_GCM_MIDDLE(p, rounds) do {                                       \
+        gl = gm = gh = (v2di){ 0, 0 };                                         \
+        AESNI_ENC8(k[1]);                                                      \
+        clmul_acc(acc ^ bswap128(load128(p)), hp[7], &gl, &gm, &gh);           \
+        AESNI_ENC8(k[2]); AESNI_GHASH_BLOCK(p, 1);                             \
+        AESNI_ENC8(k[3]); AESNI_GHASH_BLOCK(p, 2);                             \
+        AESNI_ENC8(k[4]); AESNI_GHASH_BLOCK(p, 3);                             \
+        AESNI_ENC8(k[5]); AESNI_GHASH_BLOCK(p, 4);                             \
+        AESNI_ENC8(k[6]); AESNI_GHASH_BLOCK(p, 5);                             \
+        AESNI_ENC8(k[7]); AESNI_GHASH_BLOCK(p, 6);                             \
+        AESNI_ENC8(k[8]); AESNI_GHASH_BLOCK(p, 7);                             \
+        AESNI_ENC8(k[9]); acc = clmul_reduce(gl, gm, gh);                      \
+        if ((rounds) > 10) {                                                   \
+            AESNI_ENC8(k[10]); AESNI_ENC8(k[11]);                              \
+        }                                                                      \
+        if ((rounds) > 12) {                                                   \
+            AESNI_ENC8(k[12]); AESNI_ENC8(k[13]);                              \
+        }                                                                      \
+    } while (0)
+
+/*
+ * GCM text: CTR keystream and GHASH of the ciphertext in one pass.
+ * Decryption hashes each batch's ciphertext under its own rounds; an
+ * encrypted batch is hashed under the rounds of the batch after it.
+ */
+static __always_inline void aesni_gcm_crypt(const struct aes_ctx *ctx, unsigned int rounds, const u8 *h, u8 *x,
+                                            u8 *ctr, u8 *dst, const u8 *src, unsigned int nblocks, bool enc) {
+    v2di k[AES_MAX_ROUNDS + 1];
+    v2di b0, b1, b2, b3, b4, b5, b6, b7;
+    v2di hp[8], gl, gm, gh;
+    v2di acc = bswap128(load128(x));
+    u64 hi = aes_load_be64(ctr), lo = aes_load_be64(ctr + 8);
+    v2di c = { (long long)lo, (long long)hi };
+    bool pending = false;  // encryption: the last batch written is not hashed yet
+
+    aesni_load_keys(k, ctx->key_enc, rounds);
+    aesni_ghash_powers(hp, h);
+
+    for (; nblocks >= 8; nblocks -= 8) {
+        AESNI_CTR8(k[0]);
+        if (enc && !pending)
+            AESNI_MIDDLE(AESNI_ENC8, rounds);
+        else
+            AESNI_GCM_MIDDLE(enc ? dst - 8 * AES_BLOCK_SIZE : src, rounds);
+        AESNI_ROUND8(__builtin_ia32_aesenclast128, k[rounds]);
+        AESNI_XOR8(src);
+        AESNI_STORE8(dst);
+        pending = enc;
+        src += 8 * AES_BLOCK_SIZE;
+        dst += 8 * AES_BLOCK_SIZE;
+    }
+
+    if (pending)
+        acc = aesni_ghash8(acc, hp, dst - 8 * AES_BLOCK_SIZE);
+
+    for (; nblocks; nblocks--) {
+        b0 = bswap128(c) ^ k[0];
+        aesni_ctr_add(&c, &hi, &lo, 1);
+        if (!enc)
+            acc = clmul_gfmul(acc ^ bswap128(load128(src)), hp[0]);
+        AESNI_MIDDLE(AESNI_ENC1, rounds);
+        b0 = __builtin_ia32_aesenclast128(b0, k[rounds]) ^ load128(src);
+        store128(dst, b0);
+        if (enc)
+            acc = clmul_gfmul(acc ^ bswap128(b0), hp[0]);
+        src += AES_BLOCK_SIZE;
+        dst += AES_BLOCK_SIZE;
+    }
+
+    store128(x, bswap128(acc));
+    aes_store_be64(ctr, hi);
+    aes_store_be64(ctr + 8, lo);
+}
+
+static bool aesni_usable(void) {
+    // The counter blocks are byte-swapped with PSHUFB
+    return boot_cpu_has(X86_FEATURE_AES) && boot_cpu_has(X86_FEATURE_SSSE3);
+}
+
+static bool aesni_has_clmul(void) {
+    return boot_cpu_has(X86_FEATURE_PCLMULQDQ) && boot_cpu_has(X86_FEATURE_SSSE3);
+}
+
+static void aesni_begin(void) {
+    kernel_fpu_begin();
+}
+
+static void aesni_end(void) {
+    kernel_fpu_end();
+}
+
+// One copy of the cipher entry points per key size, each with its round count built in
+#define AESNI_SIZED(rounds)                                                                               \
+    static void aesni_encrypt_##rounds(const struct aes_ctx *ctx, u8 *dst, const u8 *src,                 \
+                                       unsigned int nblocks) {                                            \
+        aesni_crypt(ctx->key_enc, rounds, true, dst, src, nblocks);                                       \
+    }                                                                                                     \
+                                                                                                          \
+    static void aesni_decrypt_##rounds(const struct aes_ctx *ctx, u8 *dst, const u8 *src,                 \
+                                       unsigned int nblocks) {                                            \
+        aesni_crypt(ctx->key_dec, rounds, false, dst, src, nblocks);                                      \
+    }                                                                                                     \
+                                                                                                          \
+    static void aesni_cbc_encrypt_##rounds(const struct aes_ctx *ctx, u8 *iv, u8 *dst, const u8 *src,     \
+                                           unsigned int nblocks) {                                        \
+        aesni_cbc_encrypt(ctx, rounds, iv, dst, src, nblocks);                                            \
+    }                                                                                                     \
+                                                                                                          \
+    static void aesni_ctr_crypt_##rounds(const struct aes_ctx *ctx, u8 *ctr, u8 *dst, const u8 *src,      \
+                                         unsigned int nblocks) {                                          \
+        aesni_ctr_crypt(ctx, rounds, ctr, dst, src, nblocks);                                             \
+    }                                                                                                     \
+                                                                                                          \
+    static void aesni_gcm_crypt_##rounds(const struct aes_ctx *ctx, const u8 *h, u8 *x, u8 *ctr, u8 *dst, \
+                                         const u8 *src, unsigned int nblocks, bool enc) {                 \
+        if (enc)                                                                                          \
+            aesni_gcm_crypt(ctx, rounds, h, x, ctr, dst, src, nblocks, true);                             \
+        else                                                                                              \
+            aesni_gcm_crypt(ctx, rounds, h, x, ctr, dst, src, nblocks, false);                            \
+    }                                                                                                     \
+                                                                                                          \
+    static const struct aes_impl aes_impl_aesni_##rounds = {                                              \
+        .name        = "aesni",                                                                           \
+        .encrypt     = aesni_encrypt_##rounds,                                                            \
+        .decrypt     = aesni_decrypt_##rounds,                                                            \
+        .cbc_encrypt = aesni_cbc_encrypt_##rounds,                                                        \
+        .ctr_crypt   = aesni_ctr_crypt_##rounds,                                                          \
+        .ghash       = aesni_ghash,                                                                       \
+        .gcm_crypt   = aesni_gcm_crypt_##rounds,                                                          \
+        .begin       = aesni_begin,                                                                       \
+        .end         = aesni_end,                                                                         \
+    };
+
+AESNI_SIZED(10)
+AESNI_SIZED(12)
+AESNI_SIZED(14)
+
+const struct aes_impl aes_impl_aesni = {
+    .name      = "aesni",
+    .usable    = aesni_usable,
+    .has_clmul = aesni_has_clmul,
+    .sized     = { &aes_impl_aesni_10, &aes_impl_aesni_12, &aes_impl_aesni_14 },
+};
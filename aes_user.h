@@ -0,0 +1,70 @@
+#ifndef _AES_USER_H
+#define _AES_USER_H
+
+/*
+ * Just enough of the kernel environment to build the cipher sources
+ * (aes_core.c, aes_modes.c, aes_gcm.c, aes_bs.c and the SIMD backend) as
+ * part of a normal program, the benchmark in main.c. aes_core.h pulls this
+ * in whenever __KERNEL__ is not defined; the module never sees it.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define min_t(type, x, y) ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define max_t(type, x, y) ((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#ifndef __always_inline  // glibc's <sys/cdefs.h> has one
+#define __always_inline inline __attribute__((__always_inline__))
+#endif
+#define __cacheline_aligned __attribute__((__aligned__(64)))
+#define ____cacheline_aligned __cacheline_aligned
+
+// IS_ENABLED() as in <linux/kconfig.h>, for the architecture symbols
+#if defined(__x86_64__)
+#define CONFIG_X86_64 1
+#elif defined(__aarch64__)
+#define CONFIG_ARM64 1
+#endif
+
+#define __ARG_PLACEHOLDER_1 0,
+#define __take_second_arg(__ignored, val, ...) val
+#define __is_defined(x) ___is_defined(x)
+#define ___is_defined(val) ____is_defined(__ARG_PLACEHOLDER_##val)
+#define ____is_defined(arg1_or_junk) __take_second_arg(arg1_or_junk 1, 0)
+#define IS_ENABLED(option) __is_defined(option)
+
+// SIMD registers belong to the thread in userspace, there is nothing to save
+#if IS_ENABLED(CONFIG_X86_64)
+#define kernel_fpu_begin() do { } while (0)
+#define kernel_fpu_end() do { } while (0)
+
+#define X86_FEATURE_AES "aes"
+#define X86_FEATURE_XMM2 "sse2"
+#define X86_FEATURE_SSSE3 "ssse3"
+#define X86_FEATURE_PCLMULQDQ "pclmul"
+#define boot_cpu_has(feature) __builtin_cpu_supports(feature)
+#endif
+
+#if IS_ENABLED(CONFIG_ARM64)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+
+#define kernel_neon_begin() do { } while (0)
+#define kernel_neon_end() do { } while (0)
+
+#define cpu_have_named_feature(name) (!!(getauxval(AT_HWCAP) & HWCAP_##name))
+#endif
+
+#endif /* _AES_USER_H */
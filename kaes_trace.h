@@ -0,0 +1,121 @@
+/*
+ * Tracepoints on the request path of the aes_ct device. Each event carries
+ * the session id, so ftrace, perf or bpftrace can pair the entry and exit
+ * of one request and attribute its latency:
+ *
+ *   perf record -e 'kaes:*' -a -- <workload>
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM kaes
+
+#if !defined(_KAES_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KAES_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// enum text_mode in aes.c
+#define kaes_show_mode(mode)    \
+    __print_symbolic(mode,      \
+        { 0, "cbc" },           \
+        { 1, "ctr" },           \
+        { 2, "gcm" },           \
+        { 3, "xts" })
+
+// A session begins or ends
+DECLARE_EVENT_CLASS(kaes_session,
+    TP_PROTO(u32 id, int mode, const char *backend),
+    TP_ARGS(id, mode, backend),
+
+    TP_STRUCT__entry(
+        __field(u32, id)
+        __field(int, mode)
+        __string(backend, backend)
+    ),
+
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->mode = mode;
+        __assign_str(backend, backend);
+    ),
+
+    TP_printk("session=%u mode=%s backend=%s",
+              __entry->id, kaes_show_mode(__entry->mode), __get_str(backend))
+);
+
+DEFINE_EVENT(kaes_session, kaes_open,
+    TP_PROTO(u32 id, int mode, const char *backend),
+    TP_ARGS(id, mode, backend));
+
+DEFINE_EVENT(kaes_session, kaes_release,
+    TP_PROTO(u32 id, int mode, const char *backend),
+    TP_ARGS(id, mode, backend));
+
+// Work of @size bytes starts
+DECLARE_EVENT_CLASS(kaes_request,
+    TP_PROTO(u32 id, int mode, const char *backend, unsigned long size),
+    TP_ARGS(id, mode, backend, size),
+
+    TP_STRUCT__entry(
+        __field(u32, id)
+        __field(int, mode)
+        __field(unsigned long, size)
+        __string(backend, backend)
+    ),
+
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->mode = mode;
+        __entry->size = size;
+        __assign_str(backend, backend);
+    ),
+
+    TP_printk("session=%u mode=%s backend=%s size=%lu",
+              __entry->id, kaes_show_mode(__entry->mode), __get_str(backend), __entry->size)
+);
+
+DEFINE_EVENT(kaes_request, kaes_write_enter,
+    TP_PROTO(u32 id, int mode, const char *backend, unsigned long size),
+    TP_ARGS(id, mode, backend, size));
+
+DEFINE_EVENT(kaes_request, kaes_cipher_start,
+    TP_PROTO(u32 id, int mode, const char *backend, unsigned long size),
+    TP_ARGS(id, mode, backend, size));
+
+// Work ends with @ret: bytes transferred, 0, or a negative errno
+DECLARE_EVENT_CLASS(kaes_result,
+    TP_PROTO(u32 id, long ret),
+    TP_ARGS(id, ret),
+
+    TP_STRUCT__entry(
+        __field(u32, id)
+        __field(long, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->id = id;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("session=%u ret=%ld", __entry->id, __entry->ret)
+);
+
+DEFINE_EVENT(kaes_result, kaes_write_exit,
+    TP_PROTO(u32 id, long ret),
+    TP_ARGS(id, ret));
+
+DEFINE_EVENT(kaes_result, kaes_cipher_finish,
+    TP_PROTO(u32 id, long ret),
+    TP_ARGS(id, ret));
+
+DEFINE_EVENT(kaes_result, kaes_read_done,
+    TP_PROTO(u32 id, long ret),
+    TP_ARGS(id, ret));
+
+#endif /* _KAES_TRACE_H */
+
+// Outside the include guard: define_trace.h reads this file again
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE kaes_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,553 @@
+/*
+ * Out-of-line half of the kernel mock (see kshim.h): the registry standing
+ * in for /dev, sysfs and debugfs, module parameters, per-CPU areas, work
+ * items and the lock contention counters.
+ */
+#include <malloc.h>
+#include <stdarg.h>
+#include <sys/eventfd.h>
+
+#include "kshim.h"
+
+static struct task_struct kshim_task = { .mm = &(struct mm_struct){ 0 } };
+struct task_struct *current = &kshim_task;
+unsigned int kshim_euid;
+
+int hex2bin(u8 *dst, const char *src, size_t count) {
+    while (count--) {
+        char hi[3] = { src[0], src[1], 0 };
+        char *end;
+
+        if (!src[0] || !src[1])
+            return -EINVAL;
+        *dst++ = strtoul(hi, &end, 16);
+        if (end != hi + 2)
+            return -EINVAL;
+        src += 2;
+    }
+    return 0;
+}
+
+// Memory
+
+void kfree_sensitive(const void *p) {
+    if (p)
+        memzero_explicit((void *)p, malloc_usable_size((void *)p));
+    free((void *)p);
+}
+
+void kvfree_sensitive(const void *p, size_t len) {
+    if (p)
+        memzero_explicit((void *)p, len);
+    free((void *)p);
+}
+
+void *vmalloc(unsigned long size) {
+    return aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+}
+
+void *vmalloc_user(unsigned long size) {
+    void *p = vmalloc(size);
+
+    if (p)
+        memset(p, 0, PAGE_ALIGN(size));
+    return p;
+}
+
+void vfree(const void *p) {
+    free((void *)p);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size, unsigned int align,
+                                     unsigned int flags, void (*ctor)(void *)) {
+    struct kmem_cache *cache = calloc(1, sizeof(*cache));
+
+    if (!cache)
+        return NULL;
+    cache->align = flags & SLAB_HWCACHE_ALIGN ? L1_CACHE_BYTES : sizeof(void *);
+    if (align > cache->align)
+        cache->align = align;
+    cache->size = (size + cache->align - 1) & ~(cache->align - 1);
+    return cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t gfp) {
+    return aligned_alloc(cache->align, cache->size);
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cache, gfp_t gfp) {
+    void *p = aligned_alloc(cache->align, cache->size);
+
+    if (p)
+        memset(p, 0, cache->size);
+    return p;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *p) {
+    free(p);
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache) {
+    free(cache);
+}
+
+mempool_t *mempool_create_slab_pool(int min_nr, struct kmem_cache *cache) {
+    mempool_t *pool = calloc(1, sizeof(*pool));
+
+    if (pool)
+        pool->cache = cache;
+    return pool;
+}
+
+void *mempool_alloc(mempool_t *pool, gfp_t gfp) {
+    void *p;
+
+    // A kernel mempool with __GFP_DIRECT_RECLAIM waits instead of failing
+    while (!(p = kmem_cache_zalloc(pool->cache, gfp)))
+        sched_yield();
+    return p;
+}
+
+void mempool_free(void *element, mempool_t *pool) {
+    kmem_cache_free(pool->cache, element);
+}
+
+void mempool_destroy(mempool_t *pool) {
+    free(pool);
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i) {
+    bytes = min_t(size_t, bytes, i->count);
+    memcpy(i->buf, addr, bytes);
+    i->buf += bytes;
+    i->count -= bytes;
+    return bytes;
+}
+
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i) {
+    bytes = min_t(size_t, bytes, i->count);
+    memcpy(addr, i->buf, bytes);
+    i->buf += bytes;
+    i->count -= bytes;
+    return bytes;
+}
+
+// xarray, as a table allocated on first use
+
+static void **xa_slots(struct xarray *xa) {
+    if (!xa->slots)
+        xa->slots = calloc(KSHIM_XA_SLOTS, sizeof(*xa->slots));
+    return xa->slots;
+}
+
+void *xa_load(struct xarray *xa, unsigned long index) {
+    return index < KSHIM_XA_SLOTS && xa->slots ? xa->slots[index] : NULL;
+}
+
+void *xa_erase(struct xarray *xa, unsigned long index) {
+    void *entry = xa_load(xa, index);
+
+    if (entry)
+        xa->slots[index] = NULL;
+    return entry;
+}
+
+// Handles start at 1, as with DEFINE_XARRAY_ALLOC1()
+int xa_alloc_cyclic(struct xarray *xa, u32 *id, void *entry, struct xa_limit limit, u32 *next, gfp_t gfp) {
+    void **slots = xa_slots(xa);
+    u32 i, n;
+
+    if (!slots)
+        return -ENOMEM;
+    for (i = 0; i < limit.max; i++) {
+        n = 1 + (*next + i - 1) % limit.max;
+        if (!slots[n]) {
+            slots[n] = entry;
+            *id = n;
+            *next = n + 1;
+            return 0;
+        }
+    }
+    return -EBUSY;
+}
+
+void xa_destroy(struct xarray *xa) {
+    free(xa->slots);
+    xa->slots = NULL;
+}
+
+// Locks
+
+static struct kshim_lock_stats lock_stats;
+
+void mutex_lock(struct mutex *m) {
+    u64 start;
+
+    __atomic_add_fetch(&lock_stats.acquired, 1, __ATOMIC_RELAXED);
+    if (!pthread_mutex_trylock(&m->lock))
+        return;
+
+    start = ktime_get_ns();
+    pthread_mutex_lock(&m->lock);
+    __atomic_add_fetch(&lock_stats.contended, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lock_stats.wait_ns, ktime_get_ns() - start, __ATOMIC_RELAXED);
+}
+
+void kshim_lock_stats(struct kshim_lock_stats *st) {
+    st->acquired = __atomic_load_n(&lock_stats.acquired, __ATOMIC_RELAXED);
+    st->contended = __atomic_load_n(&lock_stats.contended, __ATOMIC_RELAXED);
+    st->wait_ns = __atomic_load_n(&lock_stats.wait_ns, __ATOMIC_RELAXED);
+}
+
+// Per-CPU areas: one copy of the kshim_percpu section per slot
+
+extern char __start_kshim_percpu[] __attribute__((weak));
+extern char __stop_kshim_percpu[] __attribute__((weak));
+
+static char *percpu_base;
+static size_t percpu_size;
+static pthread_once_t percpu_once = PTHREAD_ONCE_INIT;
+static int percpu_next;
+static __thread int percpu_cpu = -1;
+
+static void percpu_setup(void) {
+    percpu_size = L1_CACHE_ALIGN(__stop_kshim_percpu - __start_kshim_percpu);
+    percpu_base = aligned_alloc(L1_CACHE_BYTES, percpu_size * KSHIM_NR_CPUS);
+    if (!percpu_base) {
+        fprintf(stderr, "kshim: out of memory for per-CPU data\n");
+        abort();
+    }
+    memset(percpu_base, 0, percpu_size * KSHIM_NR_CPUS);
+}
+
+void *kshim_per_cpu_ptr(const void *ptr, int cpu) {
+    pthread_once(&percpu_once, percpu_setup);
+    return percpu_base + cpu * percpu_size + ((const char *)ptr - __start_kshim_percpu);
+}
+
+int kshim_this_cpu(void) {
+    if (percpu_cpu < 0)
+        percpu_cpu = __atomic_fetch_add(&percpu_next, 1, __ATOMIC_RELAXED) % KSHIM_NR_CPUS;
+    return percpu_cpu;
+}
+
+// Work items
+
+static void *work_thread(void *arg) {
+    struct work_struct *work = arg;
+
+    work->func(work);
+    return NULL;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags, int max_active, ...) {
+    static int wq;
+
+    return (struct workqueue_struct *)&wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq) {
+}
+
+// A work item queued while it runs goes again once it is done, as in the kernel
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work) {
+    flush_work(work);
+    if (pthread_create(&work->thread, NULL, work_thread, work)) {
+        // No thread to spare: run it here rather than lose it
+        work->func(work);
+        return true;
+    }
+    work->running = true;
+    return true;
+}
+
+bool flush_work(struct work_struct *work) {
+    if (!work->running)
+        return false;
+    pthread_join(work->thread, NULL);
+    work->running = false;
+    return true;
+}
+
+bool cancel_work_sync(struct work_struct *work) {
+    return flush_work(work);
+}
+
+// eventfd
+
+struct eventfd_ctx {
+    int fd;
+};
+
+struct eventfd_ctx *eventfd_ctx_fdget(int fd) {
+    struct eventfd_ctx *ctx;
+
+    if (fd < 0)
+        return ERR_PTR(-EBADF);
+    ctx = malloc(sizeof(*ctx));
+    if (!ctx)
+        return ERR_PTR(-ENOMEM);
+    ctx->fd = dup(fd);
+    if (ctx->fd < 0) {
+        free(ctx);
+        return ERR_PTR(-EBADF);
+    }
+    return ctx;
+}
+
+void eventfd_ctx_put(struct eventfd_ctx *ctx) {
+    close(ctx->fd);
+    free(ctx);
+}
+
+u64 eventfd_signal(struct eventfd_ctx *ctx, u64 n) {
+    return eventfd_write(ctx->fd, n) ? 0 : n;
+}
+
+// Module parameters
+
+#define KSHIM_MAX_PARAMS 32
+
+static struct kshim_param {
+    const char *name;
+    const char *type;
+    void *addr;
+} params[KSHIM_MAX_PARAMS];
+static int nr_params;
+
+void kshim_param_add(const char *name, const char *type, void *addr) {
+    if (nr_params < KSHIM_MAX_PARAMS)
+        params[nr_params++] = (struct kshim_param){ name, type, addr };
+}
+
+int kshim_param_set(const char *name, const char *value) {
+    int i;
+
+    for (i = 0; i < nr_params; i++) {
+        if (strcmp(params[i].name, name))
+            continue;
+        if (!strcmp(params[i].type, "charp"))
+            *(char **)params[i].addr = strdup(value);
+        else if (!strcmp(params[i].type, "bool"))
+            *(bool *)params[i].addr = strtol(value, NULL, 0);
+        else if (!strcmp(params[i].type, "uint"))
+            *(unsigned int *)params[i].addr = strtoul(value, NULL, 0);
+        else
+            *(int *)params[i].addr = strtol(value, NULL, 0);
+        return 0;
+    }
+    return -ENOENT;
+}
+
+// Character device, class and device: the module registers one of each
+
+static struct cdev *chrdev;
+static struct device kshim_device;
+static struct class kshim_class;
+
+int alloc_chrdev_region(dev_t *dev, unsigned int first, unsigned int count, const char *name) {
+    *dev = first;
+    return 0;
+}
+
+void unregister_chrdev_region(dev_t dev, unsigned int count) {
+}
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops) {
+    cdev->ops = fops;
+}
+
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count) {
+    cdev->dev = dev;
+    chrdev = cdev;
+    return 0;
+}
+
+void cdev_del(struct cdev *cdev) {
+    if (chrdev == cdev)
+        chrdev = NULL;
+}
+
+struct class *class_create(struct module *owner, const char *name) {
+    kshim_class.name = name;
+    return &kshim_class;
+}
+
+void class_destroy(struct class *cls) {
+}
+
+struct device *device_create(struct class *cls, struct device *parent, dev_t devt, void *drvdata, const char *fmt, ...) {
+    kshim_device.driver_data = drvdata;
+    return &kshim_device;
+}
+
+void device_destroy(struct class *cls, dev_t devt) {
+}
+
+// sysfs and debugfs files, looked up by name
+
+#define KSHIM_MAX_FILES 16
+
+static const struct device_attribute *attrs[KSHIM_MAX_FILES];
+static struct {
+    const char *name;
+    const struct file_operations *fops;
+} debugfs_files[KSHIM_MAX_FILES];
+
+int device_create_file(struct device *dev, const struct device_attribute *attr) {
+    int i;
+
+    for (i = 0; i < KSHIM_MAX_FILES; i++) {
+        if (!attrs[i]) {
+            attrs[i] = attr;
+            return 0;
+        }
+    }
+    return -ENOSPC;
+}
+
+void device_remove_file(struct device *dev, const struct device_attribute *attr) {
+    int i;
+
+    for (i = 0; i < KSHIM_MAX_FILES; i++)
+        if (attrs[i] == attr)
+            attrs[i] = NULL;
+}
+
+static const struct device_attribute *attr_find(const char *name) {
+    int i;
+
+    for (i = 0; i < KSHIM_MAX_FILES; i++)
+        if (attrs[i] && !strcmp(attrs[i]->name, name))
+            return attrs[i];
+    return NULL;
+}
+
+bool sysfs_streq(const char *s1, const char *s2) {
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    if (*s1 == *s2)
+        return true;
+    if (!*s1 && *s2 == '\n' && !s2[1])
+        return true;
+    return *s1 == '\n' && !s1[1] && !*s2;
+}
+
+int __sysfs_match_string(const char * const *array, size_t n, const char *str) {
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (array[i] && sysfs_streq(array[i], str))
+            return i;
+    return -EINVAL;
+}
+
+int sysfs_emit_at(char *buf, int at, const char *fmt, ...) {
+    va_list args;
+    int len;
+
+    if (at < 0 || at >= (int)PAGE_SIZE)
+        return 0;
+    va_start(args, fmt);
+    len = vsnprintf(buf + at, PAGE_SIZE - at, fmt, args);
+    va_end(args);
+    return min_t(int, len, PAGE_SIZE - at - 1);
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent) {
+    return NULL;
+}
+
+void debugfs_create_file(const char *name, unsigned int mode, struct dentry *parent, void *data,
+                         const struct file_operations *fops) {
+    int i;
+
+    for (i = 0; i < KSHIM_MAX_FILES; i++) {
+        if (!debugfs_files[i].name) {
+            debugfs_files[i].name = name;
+            debugfs_files[i].fops = fops;
+            return;
+        }
+    }
+}
+
+void debugfs_remove_recursive(struct dentry *dentry) {
+    memset(debugfs_files, 0, sizeof(debugfs_files));
+}
+
+// The harness API
+
+int kshim_open(struct file *file) {
+    static struct inode inode;
+
+    if (!chrdev || !chrdev->ops->open)
+        return -ENODEV;
+    inode.i_cdev = chrdev;
+    memset(file, 0, sizeof(*file));
+    return chrdev->ops->open(&inode, file);
+}
+
+int kshim_release(struct file *file) {
+    struct inode inode = { .i_cdev = chrdev };
+
+    return chrdev->ops->release ? chrdev->ops->release(&inode, file) : 0;
+}
+
+// read_iter/write_iter if the driver has them, else the older read/write
+ssize_t kshim_read(struct file *file, void *buf, size_t len) {
+    const struct file_operations *fops = chrdev->ops;
+    struct kiocb iocb = { .ki_filp = file };
+    struct iov_iter iter;
+
+    if (fops->read_iter) {
+        iov_iter_init_buf(&iter, buf, len);
+        return fops->read_iter(&iocb, &iter);
+    }
+    return fops->read ? fops->read(file, buf, len, &file->f_pos) : -EINVAL;
+}
+
+ssize_t kshim_write(struct file *file, const void *buf, size_t len) {
+    const struct file_operations *fops = chrdev->ops;
+    struct kiocb iocb = { .ki_filp = file };
+    struct iov_iter iter;
+
+    if (fops->write_iter) {
+        iov_iter_init_buf(&iter, (void *)buf, len);
+        return fops->write_iter(&iocb, &iter);
+    }
+    return fops->write ? fops->write(file, buf, len, &file->f_pos) : -EINVAL;
+}
+
+long kshim_ioctl(struct file *file, unsigned int cmd, void *arg) {
+    if (!chrdev->ops->unlocked_ioctl)
+        return -ENOTTY;
+    return chrdev->ops->unlocked_ioctl(file, cmd, (unsigned long)arg);
+}
+
+ssize_t kshim_attr_show(const char *name, char *buf) {
+    const struct device_attribute *attr = attr_find(name);
+
+    if (!attr || !attr->show)
+        return -ENOENT;
+    return attr->show(&kshim_device, (struct device_attribute *)attr, buf);
+}
+
+ssize_t kshim_attr_store(const char *name, const char *buf) {
+    const struct device_attribute *attr = attr_find(name);
+
+    if (!attr || !attr->store)
+        return -ENOENT;
+    return attr->store(&kshim_device, (struct device_attribute *)attr, buf, strlen(buf));
+}
+
+int kshim_debugfs_show(const char *name, FILE *out) {
+    struct seq_file m = { .out = out };
+    int i;
+
+    for (i = 0; i < KSHIM_MAX_FILES; i++)
+        if (debugfs_files[i].name && !strcmp(debugfs_files[i].name, name))
+            return debugfs_files[i].fops->show(&m, NULL);
+    return -ENOENT;
+}
@@ -0,0 +1,663 @@
+#ifndef _KSHIM_H
+#define _KSHIM_H
+
+/*
+ * A mock of the kernel interfaces the driver uses, so aes.c builds unchanged
+ * as part of a userspace program (the load generator in loadgen.c). The
+ * <linux/...> headers under kshim/ all land here. Locks, wait queues and
+ * work items are real pthread objects, so concurrency behaves as it would
+ * in the kernel; "user" pointers are plain pointers into the same process.
+ * Everything that needs state of its own lives in kshim.c.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+
+// <linux/types.h>, with the kernel's integer widths
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef unsigned int fmode_t;
+typedef unsigned int gfp_t;
+typedef unsigned int __poll_t;
+
+// <linux/compiler.h>
+#define __user
+#define __init
+#define __exit
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+// <linux/kernel.h>
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define min_t(type, x, y) ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define max_t(type, x, y) ((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+#define min3(x, y, z) min_t(__typeof__(x), min_t(__typeof__(x), x, y), z)
+#define rounddown(x, y) ((x) - (x) % (y))
+#define round_down(x, y) ((x) & ~((__typeof__(x))(y) - 1))
+#define round_up(x, y) ((((x) - 1) | ((__typeof__(x))(y) - 1)) + 1)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define pr_debug(...) do { } while (0)
+
+int hex2bin(u8 *dst, const char *src, size_t count);
+
+static inline void cond_resched(void) {
+}
+
+// <linux/err.h>
+#define MAX_ERRNO 4095
+#define IS_ERR(p) ((unsigned long)(p) >= (unsigned long)-MAX_ERRNO)
+#define PTR_ERR(p) ((long)(p))
+#define ERR_PTR(e) ((void *)(long)(e))
+
+// <linux/errno.h>, the codes userspace never sees
+#define ERESTARTSYS 512
+
+// <linux/log2.h>
+#define ilog2(n) (63 - __builtin_clzll(n))
+
+static inline bool is_power_of_2(unsigned long n) {
+    return n && !(n & (n - 1));
+}
+
+// <linux/cache.h>
+#define L1_CACHE_BYTES 64
+#define L1_CACHE_ALIGN(x) (((x) + L1_CACHE_BYTES - 1) & ~(L1_CACHE_BYTES - 1UL))
+#define ____cacheline_aligned __attribute__((__aligned__(L1_CACHE_BYTES)))
+
+// <linux/string.h>
+static inline void memzero_explicit(void *p, size_t n) {
+    memset(p, 0, n);
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+// <crypto/algapi.h>
+static inline int crypto_memneq(const void *a, const void *b, size_t n) {
+    const u8 *x = a, *y = b;
+    u8 d = 0;
+
+    while (n--)
+        d |= *x++ ^ *y++;
+    return d != 0;
+}
+
+// <linux/slab.h>, <linux/vmalloc.h>
+#define GFP_KERNEL 0
+#define SLAB_HWCACHE_ALIGN 1
+
+static inline void *kmalloc(size_t n, gfp_t gfp) { return malloc(n); }
+static inline void *kzalloc(size_t n, gfp_t gfp) { return calloc(1, n); }
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t gfp) { return calloc(n, size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp) { return calloc(n, size); }
+static inline void *kvmalloc(size_t n, gfp_t gfp) { return malloc(n); }
+static inline void kfree(const void *p) { free((void *)p); }
+static inline void kvfree(const void *p) { free((void *)p); }
+
+void kfree_sensitive(const void *p);  // needs the allocation size, see kshim.c
+void kvfree_sensitive(const void *p, size_t len);
+void *vmalloc(unsigned long size);
+void *vmalloc_user(unsigned long size);
+void vfree(const void *p);
+
+struct kmem_cache {
+    size_t size;
+    size_t align;
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size, unsigned int align,
+                                     unsigned int flags, void (*ctor)(void *));
+void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t gfp);
+void *kmem_cache_zalloc(struct kmem_cache *cache, gfp_t gfp);
+void kmem_cache_free(struct kmem_cache *cache, void *p);
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+// <linux/mempool.h>: malloc() doesn't run dry here, so there is no reserve to keep
+typedef struct mempool_s {
+    struct kmem_cache *cache;
+} mempool_t;
+
+mempool_t *mempool_create_slab_pool(int min_nr, struct kmem_cache *cache);
+void *mempool_alloc(mempool_t *pool, gfp_t gfp);
+void mempool_free(void *element, mempool_t *pool);
+void mempool_destroy(mempool_t *pool);
+
+// <linux/mm.h>, as far as the kcapi scatterlists, mmap and page pinning need it
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define PAGE_MASK (~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define offset_in_page(p) ((unsigned long)(p) & (PAGE_SIZE - 1))
+
+struct page;
+struct vm_area_struct {
+    unsigned long vm_start, vm_end, vm_pgoff;
+};
+
+static inline bool is_vmalloc_addr(const void *p) { return true; }
+static inline struct page *vmalloc_to_page(const void *p) { return (struct page *)((unsigned long)p & ~(PAGE_SIZE - 1)); }
+#define virt_to_page(p) vmalloc_to_page(p)
+
+// There is no second mapping to make in one address space
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff) {
+    return -ENODEV;
+}
+
+/*
+ * Pinning hands back the user pages themselves, which are already mapped
+ * here. A page is its address, as in vmalloc_to_page(), so pages pinned
+ * together map at the first one's address.
+ */
+#define FOLL_WRITE 0x01
+#define NUMA_NO_NODE (-1)
+
+static inline int pin_user_pages_fast(unsigned long start, int nr_pages, unsigned int gup_flags, struct page **pages) {
+    int i;
+
+    for (i = 0; i < nr_pages; i++)
+        pages[i] = (struct page *)(start + i * PAGE_SIZE);
+    return nr_pages;
+}
+
+static inline void unpin_user_pages(struct page **pages, unsigned long npages) { }
+static inline void unpin_user_pages_dirty_lock(struct page **pages, unsigned long npages, bool make_dirty) { }
+static inline void *vm_map_ram(struct page **pages, unsigned int count, int node) { return pages[0]; }
+static inline void vm_unmap_ram(const void *mem, unsigned int count) { }
+
+// <linux/uaccess.h>: userspace is this process, every pointer is valid
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n) {
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n) {
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline long strncpy_from_user(char *dst, const char __user *src, long count) {
+    long i;
+
+    for (i = 0; i < count; i++)
+        if (!(dst[i] = src[i]))
+            return i;
+    return count;
+}
+
+#define get_user(x, p) ((x) = *(p), 0)
+#define put_user(x, p) (*(p) = (x), 0)
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+#define access_ok(addr, size) ((uintptr_t)(addr) + (size) >= (uintptr_t)(addr))
+
+// <linux/uio.h>: a single user buffer, which is all read()/write() make
+struct iov_iter {
+    char *buf;
+    size_t count;
+};
+
+static inline void iov_iter_init_buf(struct iov_iter *i, void *buf, size_t count) {
+    i->buf = buf;
+    i->count = count;
+}
+
+static inline size_t iov_iter_count(const struct iov_iter *i) {
+    return i->count;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i);
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i);
+
+// <linux/atomic.h>, <linux/kref.h>
+typedef struct {
+    int counter;
+} atomic_t;
+
+#define atomic_inc_return(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+
+struct kref {
+    atomic_t refcount;
+};
+
+static inline void kref_init(struct kref *kref) {
+    kref->refcount.counter = 1;
+}
+
+static inline void kref_get(struct kref *kref) {
+    __atomic_add_fetch(&kref->refcount.counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline int kref_put(struct kref *kref, void (*release)(struct kref *kref)) {
+    if (__atomic_sub_fetch(&kref->refcount.counter, 1, __ATOMIC_ACQ_REL))
+        return 0;
+    release(kref);
+    return 1;
+}
+
+// <linux/list.h>
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD(name) struct list_head name = { &(name), &(name) }
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_last_entry(head, type, member) list_entry((head)->prev, type, member)
+#define list_for_each_entry_safe(pos, n, head, member)                          \
+    for (pos = list_entry((head)->next, __typeof__(*pos), member),               \
+         n = list_entry(pos->member.next, __typeof__(*pos), member);             \
+         &pos->member != (head);                                                 \
+         pos = n, n = list_entry(n->member.next, __typeof__(*n), member))
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list->prev = list;
+}
+
+static inline void list_add(struct list_head *entry, struct list_head *head) {
+    entry->next = head->next;
+    entry->prev = head;
+    head->next->prev = entry;
+    head->next = entry;
+}
+
+static inline void list_del_init(struct list_head *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head *entry, struct list_head *head) {
+    list_del_init(entry);
+    list_add(entry, head);
+}
+
+// <linux/xarray.h>: a flat table, enough for the key handles
+#define KSHIM_XA_SLOTS (1 << 16)
+
+struct xarray {
+    void **slots;
+};
+
+struct xa_limit {
+    u32 max, min;
+};
+
+#define DEFINE_XARRAY_ALLOC1(name) struct xarray name
+#define xa_limit_32b ((struct xa_limit){ .max = KSHIM_XA_SLOTS - 1, .min = 0 })
+
+void *xa_load(struct xarray *xa, unsigned long index);
+void *xa_erase(struct xarray *xa, unsigned long index);
+int xa_alloc_cyclic(struct xarray *xa, u32 *id, void *entry, struct xa_limit limit, u32 *next, gfp_t gfp);
+void xa_destroy(struct xarray *xa);
+
+/*
+ * <linux/mutex.h>. Every acquisition is counted, and so is every one that
+ * found the lock taken, with the time spent waiting for it: the load
+ * generator reports these as lock contention.
+ */
+struct mutex {
+    pthread_mutex_t lock;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(m) pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_unlock(m) pthread_mutex_unlock(&(m)->lock)
+
+void mutex_lock(struct mutex *m);
+
+struct kshim_lock_stats {
+    u64 acquired;
+    u64 contended;
+    u64 wait_ns;
+};
+
+void kshim_lock_stats(struct kshim_lock_stats *st);
+
+// <linux/wait.h>, <linux/poll.h>. Nothing signals the harness, so waits are never interrupted
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} wait_queue_head_t;
+
+typedef struct {
+    int unused;
+} poll_table;
+
+#define EPOLLIN 0x0001
+#define EPOLLOUT 0x0004
+#define EPOLLERR 0x0008
+#define EPOLLRDNORM 0x0040
+#define EPOLLWRNORM 0x0100
+
+#define init_waitqueue_head(wq)                      \
+    do {                                             \
+        pthread_mutex_init(&(wq)->lock, NULL);       \
+        pthread_cond_init(&(wq)->cond, NULL);        \
+    } while (0)
+
+#define wait_event_interruptible(wq, condition)              \
+    ({                                                       \
+        pthread_mutex_lock(&(wq).lock);                      \
+        while (!(condition))                                 \
+            pthread_cond_wait(&(wq).cond, &(wq).lock);       \
+        pthread_mutex_unlock(&(wq).lock);                    \
+        0;                                                   \
+    })
+
+static inline void wake_up_interruptible(wait_queue_head_t *wq) {
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+#define wake_up(wq) wake_up_interruptible(wq)
+#define wait_event(wq, condition) ((void)wait_event_interruptible(wq, condition))
+
+struct file;
+static inline void poll_wait(struct file *file, wait_queue_head_t *wq, poll_table *p) {
+}
+
+/*
+ * <linux/percpu.h>. Each thread is a CPU: the first time it touches a per-CPU
+ * variable it is given the next free slot, and per-CPU variables live in a
+ * section that kshim.c copies once per slot. Updates are atomic only because
+ * more threads than slots may end up sharing one.
+ */
+#define KSHIM_NR_CPUS 64
+
+#define DEFINE_PER_CPU(type, name) __attribute__((section("kshim_percpu"))) __typeof__(type) name
+
+void *kshim_per_cpu_ptr(const void *ptr, int cpu);
+int kshim_this_cpu(void);
+
+#define per_cpu_ptr(ptr, cpu) ((__typeof__(ptr))kshim_per_cpu_ptr(ptr, cpu))
+#define this_cpu_ptr(ptr) per_cpu_ptr(ptr, kshim_this_cpu())
+#define this_cpu_add(var, n) __atomic_add_fetch(this_cpu_ptr(&(var)), n, __ATOMIC_RELAXED)
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < KSHIM_NR_CPUS; (cpu)++)
+
+static inline unsigned int num_online_cpus(void) {
+    return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+// Every CPU is online here, so the highest CPU number is the online count
+#define nr_cpu_ids num_online_cpus()
+
+// <linux/ktime.h>
+static inline u64 ktime_get_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// <linux/workqueue.h>: each queued item runs on a thread of its own
+struct work_struct {
+    void (*func)(struct work_struct *work);
+    pthread_t thread;
+    bool running;
+};
+
+struct workqueue_struct;
+
+#define WQ_UNBOUND 0x2
+#define INIT_WORK(w, f) ((w)->func = (f), (w)->running = false)
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags, int max_active, ...);
+void destroy_workqueue(struct workqueue_struct *wq);
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool flush_work(struct work_struct *work);
+bool cancel_work_sync(struct work_struct *work);
+
+// <linux/sched.h>, <linux/sched/mm.h>, <linux/kthread.h>: one address space
+struct mm_struct {
+    int unused;
+};
+
+struct task_struct {
+    struct mm_struct *mm;
+};
+
+extern struct task_struct *current;
+
+// <linux/cred.h>: the harness sets kshim_euid to act as another user
+typedef struct {
+    unsigned int val;
+} kuid_t;
+
+extern unsigned int kshim_euid;
+
+static inline kuid_t current_euid(void) { return (kuid_t){ kshim_euid }; }
+static inline bool uid_eq(kuid_t a, kuid_t b) { return a.val == b.val; }
+
+static inline void mmgrab(struct mm_struct *mm) { }
+static inline void mmdrop(struct mm_struct *mm) { }
+static inline bool mmget_not_zero(struct mm_struct *mm) { return true; }
+static inline void mmput(struct mm_struct *mm) { }
+static inline void kthread_use_mm(struct mm_struct *mm) { }
+static inline void kthread_unuse_mm(struct mm_struct *mm) { }
+
+// <linux/eventfd.h>, backed by a real eventfd
+struct eventfd_ctx;
+
+struct eventfd_ctx *eventfd_ctx_fdget(int fd);
+void eventfd_ctx_put(struct eventfd_ctx *ctx);
+u64 eventfd_signal(struct eventfd_ctx *ctx, u64 n);
+
+// <linux/fs.h>
+struct module;
+#define THIS_MODULE ((struct module *)0)
+
+struct cdev;
+struct kiocb {
+    struct file *ki_filp;
+};
+
+struct inode {
+    struct cdev *i_cdev;
+};
+
+struct file {
+    void *private_data;
+    unsigned int f_flags;
+    fmode_t f_mode;
+    loff_t f_pos;
+};
+
+struct seq_file;
+
+struct file_operations {
+    struct module *owner;
+    loff_t (*llseek)(struct file *, loff_t, int);
+    ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+    ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+    ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+    __poll_t (*poll)(struct file *, poll_table *);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    int (*fsync)(struct file *, loff_t, loff_t, int);
+    const void *splice_read, *splice_write;      // no pipes in the harness
+    int (*show)(struct seq_file *, void *);      // DEFINE_SHOW_ATTRIBUTE()
+};
+
+#define generic_file_splice_read NULL
+#define iter_file_splice_write NULL
+
+static inline int stream_open(struct inode *inode, struct file *file) { return 0; }
+static inline loff_t no_llseek(struct file *file, loff_t offset, int whence) { return -ESPIPE; }
+
+int alloc_chrdev_region(dev_t *dev, unsigned int first, unsigned int count, const char *name);
+void unregister_chrdev_region(dev_t dev, unsigned int count);
+
+// <linux/cdev.h>
+struct cdev {
+    const struct file_operations *ops;
+    dev_t dev;
+};
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops);
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count);
+void cdev_del(struct cdev *cdev);
+
+// <linux/device.h>
+struct class {
+    const char *name;
+};
+
+struct device {
+    void *driver_data;
+};
+
+struct device_attribute {
+    const char *name;
+    ssize_t (*show)(struct device *dev, struct device_attribute *attr, char *buf);
+    ssize_t (*store)(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+};
+
+#define DEVICE_ATTR_RW(_name) struct device_attribute dev_attr_##_name = { #_name, _name##_show, _name##_store }
+#define DEVICE_ATTR_RO(_name) struct device_attribute dev_attr_##_name = { #_name, _name##_show, NULL }
+
+static inline void *dev_get_drvdata(const struct device *dev) {
+    return dev->driver_data;
+}
+
+struct class *class_create(struct module *owner, const char *name);
+void class_destroy(struct class *cls);
+struct device *device_create(struct class *cls, struct device *parent, dev_t devt, void *drvdata, const char *fmt, ...);
+void device_destroy(struct class *cls, dev_t devt);
+int device_create_file(struct device *dev, const struct device_attribute *attr);
+void device_remove_file(struct device *dev, const struct device_attribute *attr);
+
+// <linux/sysfs.h>
+bool sysfs_streq(const char *s1, const char *s2);
+int __sysfs_match_string(const char * const *array, size_t n, const char *str);
+#define sysfs_match_string(array, str) __sysfs_match_string(array, ARRAY_SIZE(array), str)
+int sysfs_emit_at(char *buf, int at, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// <linux/seq_file.h>, <linux/debugfs.h>
+struct seq_file {
+    FILE *out;
+};
+
+#define seq_printf(m, ...) fprintf((m)->out, __VA_ARGS__)
+#define DEFINE_SHOW_ATTRIBUTE(name) \
+    static const struct file_operations name##_fops = { .owner = THIS_MODULE, .show = name##_show }
+
+struct dentry;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+void debugfs_create_file(const char *name, unsigned int mode, struct dentry *parent, void *data,
+                         const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+// <linux/moduleparam.h>: parameters are set by name before the module loads
+#define module_param(name, type, perm)                                          \
+    static void __attribute__((constructor)) kshim_param_##name(void) {         \
+        kshim_param_add(#name, #type, &name);                                   \
+    }
+#define MODULE_PARM_DESC(name, desc)
+
+void kshim_param_add(const char *name, const char *type, void *addr);
+int kshim_param_set(const char *name, const char *value);
+
+// <linux/module.h>
+#define module_init(fn) int kshim_module_init(void) { return fn(); }
+#define module_exit(fn) void kshim_module_exit(void) { fn(); }
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+
+/*
+ * <crypto/skcipher.h>, <linux/scatterlist.h>. The harness has no crypto
+ * API, so backend=kcapi fails at open with -ENOENT; the rest only has to
+ * compile.
+ */
+struct scatterlist {
+    struct page *page;
+    unsigned int length, offset;
+};
+
+struct crypto_skcipher;
+struct skcipher_request;
+struct crypto_wait {
+    int err;
+};
+
+#define CRYPTO_TFM_REQ_MAY_BACKLOG 0x400
+#define CRYPTO_TFM_REQ_MAY_SLEEP 0x200
+#define DECLARE_CRYPTO_WAIT(name) struct crypto_wait name = { 0 }
+
+struct crypto_async_request {
+    void *data;
+};
+
+typedef void (*crypto_completion_t)(struct crypto_async_request *req, int err);
+
+static inline void sg_init_table(struct scatterlist *sg, unsigned int nents) { memset(sg, 0, nents * sizeof(*sg)); }
+static inline struct scatterlist *sg_next(struct scatterlist *sg) { return sg + 1; }
+static inline void sg_set_page(struct scatterlist *sg, struct page *page, unsigned int len, unsigned int offset) {
+    sg->page = page;
+    sg->length = len;
+    sg->offset = offset;
+}
+
+static inline struct crypto_skcipher *crypto_alloc_skcipher(const char *name, u32 type, u32 mask) { return ERR_PTR(-ENOENT); }
+static inline void crypto_free_skcipher(struct crypto_skcipher *tfm) { }
+static inline int crypto_skcipher_setkey(struct crypto_skcipher *tfm, const u8 *key, unsigned int len) { return -ENOENT; }
+static inline struct skcipher_request *skcipher_request_alloc(struct crypto_skcipher *tfm, gfp_t gfp) { return NULL; }
+static inline void skcipher_request_free(struct skcipher_request *req) { }
+static inline void skcipher_request_set_callback(struct skcipher_request *req, u32 flags, crypto_completion_t done,
+                                                 void *data) { }
+static inline void skcipher_request_set_crypt(struct skcipher_request *req, struct scatterlist *src,
+                                              struct scatterlist *dst, unsigned int len, void *iv) { }
+static inline int crypto_skcipher_encrypt(struct skcipher_request *req) { return -ENOENT; }
+static inline int crypto_skcipher_decrypt(struct skcipher_request *req) { return -ENOENT; }
+static inline void crypto_req_done(struct crypto_async_request *req, int err) { }
+static inline int crypto_wait_req(int err, struct crypto_wait *wait) { return err; }
+
+// <linux/tracepoint.h>: events compile to nothing
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define DECLARE_EVENT_CLASS(...)
+#define DEFINE_EVENT(class, name, proto, args) static inline void trace_##name(proto) { }
+
+/*
+ * The harness side: a process-wide stand-in for /dev and /sys, filled in as
+ * the module registers its character device and attributes.
+ */
+int kshim_open(struct file *file);
+int kshim_release(struct file *file);
+ssize_t kshim_read(struct file *file, void *buf, size_t len);
+ssize_t kshim_write(struct file *file, const void *buf, size_t len);
+long kshim_ioctl(struct file *file, unsigned int cmd, void *arg);
+ssize_t kshim_attr_show(const char *name, char *buf);  // buf of PAGE_SIZE bytes
+ssize_t kshim_attr_store(const char *name, const char *buf);
+int kshim_debugfs_show(const char *name, FILE *out);
+
+int kshim_module_init(void);
+void kshim_module_exit(void);
+
+#endif /* _KSHIM_H */
@@ -0,0 +1,2 @@
+#include_next <linux/errno.h>  // glibc's <errno.h> comes through here too
+#include "../kshim.h"
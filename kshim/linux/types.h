@@ -0,0 +1,2 @@
+#include_next <linux/types.h>  // the __u8.. types of the uapi headers
+#include "../kshim.h"
@@ -0,0 +1 @@
+// Tracepoints compile to empty functions, see kshim.h
@@ -0,0 +1,257 @@
+/*
+ * Load generator for the driver's file operations, run in userspace on top
+ * of the kernel mock in kshim/ (see the "loadgen" target in the Makefile).
+ * aes.c is compiled unchanged; N threads drive its open/write/read/release
+ * handlers like N processes would, one or more per session, and the run
+ * reports throughput and how often the driver's mutexes were contended.
+ *
+ *   ./loadgen [-s sessions] [-j threads-per-session] [-t seconds] [-b bytes]
+ *             [-m mode] [-k hex-key] [-r rekey-ms] [-p param=value]... [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "kshim.h"
+#include "vencrypt.h"
+
+#define LOADGEN_MAX_THREADS 1024
+
+struct loadgen_session {
+    struct file file;
+};
+
+struct loadgen_thread {
+    pthread_t thread;
+    struct loadgen_session *sess;
+    u8 *buf;
+    size_t len;
+    u64 bytes_in, bytes_out, ops;
+    long error;  // first unexpected failure, 0 if none
+};
+
+static volatile int loadgen_stop;
+static unsigned int rekey_ms;
+static const char *key_hex = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+
+/*
+ * Writes a buffer, then reads back whatever the session has ready, until
+ * told to stop. Sessions are non-blocking: with several threads on one
+ * stream a write may find the queue full and a read may find it empty.
+ */
+static void *loadgen_worker(void *arg) {
+    struct loadgen_thread *t = arg;
+    struct file *file = &t->sess->file;
+    ssize_t ret;
+
+    while (!loadgen_stop) {
+        ret = kshim_write(file, t->buf, t->len);
+        t->ops++;
+        if (ret > 0)
+            t->bytes_in += ret;
+        else if (ret != -EAGAIN && !t->error)
+            t->error = ret;
+
+        do {
+            ret = kshim_read(file, t->buf, t->len);
+            t->ops++;
+            if (ret > 0)
+                t->bytes_out += ret;
+        } while (ret > 0);
+        if (ret < 0 && ret != -EAGAIN && !t->error)
+            t->error = ret;
+    }
+    return NULL;
+}
+
+// Replaces the device key every rekey_ms, as an administrator writing sysfs would
+static void *loadgen_rekey(void *arg) {
+    u64 *rekeys = arg;
+
+    while (!loadgen_stop) {
+        usleep(rekey_ms * 1000);
+        if (kshim_attr_store("key", key_hex) >= 0)
+            (*rekeys)++;
+    }
+    return NULL;
+}
+
+static int loadgen_open(struct loadgen_session *sess, const char *mode) {
+    struct vencrypt_buf vb = { 0 };
+    u8 nonce[12] = { 0 };
+    int ret;
+
+    ret = kshim_open(&sess->file);
+    if (ret < 0)
+        return ret;
+    sess->file.f_flags |= O_NONBLOCK;
+
+    // A GCM stream takes no data before its nonce
+    if (mode && !strcmp(mode, "gcm")) {
+        vb.ptr = (uintptr_t)nonce;
+        vb.len = sizeof(nonce);
+        ret = kshim_ioctl(&sess->file, VENCRYPT_IOCTL_SET_IV, &vb);
+        if (ret < 0) {
+            kshim_release(&sess->file);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-s sessions] [-j threads] [-t seconds] [-b bytes] [-m mode] [-k hex]\n"
+            "          [-r ms] [-p param=value]... [-v]\n"
+            "  -s  sessions (opens) to drive (default 1)\n"
+            "  -j  threads per session (default 1)\n"
+            "  -t  run time in seconds (default 5)\n"
+            "  -b  bytes per write, a multiple of the mode's unit (default 4096)\n"
+            "  -m  device mode for new sessions: cbc, ctr, gcm or xts (default: the driver's)\n"
+            "  -k  device key in hex (default: a fixed 256-bit key)\n"
+            "  -r  rewrite the device key every this many ms during the run\n"
+            "  -p  module parameter, before the module loads; may be repeated\n"
+            "  -v  print the driver's stats and latency histograms after the run\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    unsigned int sessions = 1, threads = 1, seconds = 5, i;
+    size_t len = 4096;
+    const char *mode = NULL;
+    struct loadgen_session *sess;
+    struct loadgen_thread *t;
+    struct kshim_lock_stats locks;
+    pthread_t rekey_thread;
+    u64 bytes_in = 0, bytes_out = 0, ops = 0, rekeys = 0, start, elapsed;
+    long error = 0;
+    int verbose = 0, opt, ret;
+
+    while ((opt = getopt(argc, argv, "s:j:t:b:m:k:r:p:vh")) != -1) {
+        switch (opt) {
+        case 's': sessions = strtoul(optarg, NULL, 0); break;
+        case 'j': threads = strtoul(optarg, NULL, 0); break;
+        case 't': seconds = strtoul(optarg, NULL, 0); break;
+        case 'b': len = strtoul(optarg, NULL, 0); break;
+        case 'm': mode = optarg; break;
+        case 'k': key_hex = optarg; break;
+        case 'r': rekey_ms = strtoul(optarg, NULL, 0); break;
+        case 'p': {
+            char *eq = strchr(optarg, '=');
+
+            if (!eq) {
+                usage(argv[0]);
+                return -EINVAL;
+            }
+            *eq = 0;
+            if (kshim_param_set(optarg, eq + 1) < 0) {
+                fprintf(stderr, "unknown module parameter '%s'\n", optarg);
+                return -EINVAL;
+            }
+            break;
+        }
+        case 'v': verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -EINVAL;
+        }
+    }
+
+    if (!sessions || !threads || !len || sessions * threads > LOADGEN_MAX_THREADS) {
+        usage(argv[0]);
+        return -EINVAL;
+    }
+
+    ret = kshim_module_init();
+    if (ret < 0) {
+        fprintf(stderr, "module init failed: %d\n", ret);
+        return ret;
+    }
+
+    // Drivers without the attributes (the older drafts) just run keyless
+    if (kshim_attr_store("key", key_hex) == -EINVAL || (mode && kshim_attr_store("mode", mode) == -EINVAL)) {
+        fprintf(stderr, "invalid key or mode\n");
+        ret = -EINVAL;
+        goto out_exit;
+    }
+
+    sess = calloc(sessions, sizeof(*sess));
+    t = calloc(sessions * threads, sizeof(*t));
+    if (!sess || !t) {
+        ret = -ENOMEM;
+        goto out_exit;
+    }
+
+    for (i = 0; i < sessions; i++) {
+        ret = loadgen_open(&sess[i], mode);
+        if (ret < 0) {
+            fprintf(stderr, "open failed: %d\n", ret);
+            while (i--)
+                kshim_release(&sess[i].file);
+            goto out_free;
+        }
+    }
+
+    start = ktime_get_ns();
+    for (i = 0; i < sessions * threads; i++) {
+        t[i].sess = &sess[i / threads];
+        t[i].len = len;
+        t[i].buf = malloc(len);
+        if (!t[i].buf) {
+            fprintf(stderr, "out of memory\n");
+            abort();
+        }
+        memset(t[i].buf, 0xa5, len);
+        pthread_create(&t[i].thread, NULL, loadgen_worker, &t[i]);
+    }
+    if (rekey_ms)
+        pthread_create(&rekey_thread, NULL, loadgen_rekey, &rekeys);
+
+    sleep(seconds);
+    loadgen_stop = 1;
+
+    for (i = 0; i < sessions * threads; i++) {
+        pthread_join(t[i].thread, NULL);
+        bytes_in += t[i].bytes_in;
+        bytes_out += t[i].bytes_out;
+        ops += t[i].ops;
+        if (t[i].error && !error)
+            error = t[i].error;
+        free(t[i].buf);
+    }
+    if (rekey_ms)
+        pthread_join(rekey_thread, NULL);
+    elapsed = ktime_get_ns() - start;
+
+    for (i = 0; i < sessions; i++)
+        kshim_release(&sess[i].file);
+
+    kshim_lock_stats(&locks);
+    printf("sessions,threads,bytes,seconds,mb_per_s,ops_per_s,rekeys,locks,contended,lock_wait_ms,error\n");
+    printf("%u,%u,%zu,%.3f,%.1f,%.0f,%llu,%llu,%llu,%.3f,%ld\n", sessions, sessions * threads, len,
+           elapsed / 1e9, (bytes_in + bytes_out) / 2 / (elapsed / 1e3), ops / (elapsed / 1e9),
+           rekeys, locks.acquired, locks.contended, locks.wait_ns / 1e6, error);
+
+    if (verbose) {
+        char *buf = malloc(PAGE_SIZE);
+
+        if (buf && kshim_attr_show("stats", buf) > 0)
+            printf("\nmode bytes_in bytes_out ops errors\n%s", buf);
+        printf("\nstage ns count\n");
+        kshim_debugfs_show("latency", stdout);
+        free(buf);
+    }
+    ret = error ? -EIO : 0;
+
+out_free:
+    free(t);
+    free(sess);
+out_exit:
+    kshim_module_exit();
+    return ret;
+}
@@ -28,8 +28,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 
-#define VENCRYPT_IOCTL_SET_KEY _IOW('v', 0, char*)
-#define VENCRYPT_IOCTL_SET_ENCRYPT _IOW('v', 1, int)
+#include "vencrypt.h"
 
 int main(int argc, char **argv) {
   if (argc < 5) {
@@ -66,8 +65,8 @@ int main(int argc, char **argv) {
   // Get the input data length
   size_t input_len = strlen(input);
 
-  // Allocate a buffer for the output data
-  char *output = malloc(input_len + 1);
+  // Allocate a buffer for the output data, with room for a block of padding
+  char *output = malloc(input_len + 16 + 1);
   if (output == NULL) {
     perror("malloc");
     close(fd);
@@ -83,7 +82,15 @@ int main(int argc, char **argv) {
       return -1;
     }
 
-    if (read(fd, output, input_len) < 0) {
+    // End of stream: the device pads (or unpads) the last block
+    if (fsync(fd) < 0) {
+      perror("fsync");
+      close(fd);
+      free(output);
+      return -1;
+    }
+
+    if (read(fd, output, input_len + 16) < 0) {
       perror("read");
       close(fd);
       free(output);
@@ -97,7 +104,15 @@ int main(int argc, char **argv) {
       return -1;
     }
 
-    if (read(fd, output, input_len) < 0) {
+    // End of stream: the device pads (or unpads) the last block
+    if (fsync(fd) < 0) {
+      perror("fsync");
+      close(fd);
+      free(output);
+      return -1;
+    }
+
+    if (read(fd, output, input_len + 16) < 0) {
       perror("read");
       close(fd);
       free(output);
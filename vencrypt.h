@@ -0,0 +1,159 @@
+#ifndef _VENCRYPT_H
+#define _VENCRYPT_H
+
+/*
+ * ioctl interface of the aes_ct device, shared by the driver and the
+ * userspace tools. Plain __u types so it builds on either side.
+ */
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// A userspace buffer: the IV/nonce or the GCM additional data
+struct vencrypt_buf {
+    __u64 ptr;
+    __u32 len;
+    __u32 reserved;  // must be 0
+};
+
+// A byte range of the mmap()ed session buffer
+struct vencrypt_range {
+    __u64 offset;
+    __u64 len;
+};
+
+// Caller memory for PROCESS_USER, any length
+struct vencrypt_span {
+    __u64 ptr;
+    __u64 len;
+};
+
+/*
+ * One independent message of a batch. Each item starts from its own IV and
+ * uses the session's key, mode and direction. No padding is added: CBC and
+ * XTS items are whole blocks (an XTS item is one data unit), CTR and GCM
+ * items any length. No item may exceed the driver's bounce_size parameter.
+ */
+struct vencrypt_item {
+    __u64 in_ptr;
+    __u64 out_ptr;   // may equal in_ptr
+    __u32 len;
+    __s32 status;    // out: 0 or a negative errno
+    __u8 iv[16];     // GCM: the 12-byte nonce, the rest is ignored
+    __u8 tag[16];    // GCM: written on encrypt, checked on decrypt
+};
+
+struct vencrypt_batch {
+    __u64 items;     // array of struct vencrypt_item
+    __u32 count;
+    __u32 reserved;  // must be 0
+};
+
+#define VENCRYPT_BATCH_MAX 4096
+
+/*
+ * Asynchronous rings, io_uring style. ASYNC_SETUP sizes them and returns
+ * where they live inside a mapping made with mmap() at VENCRYPT_MMAP_ASYNC.
+ * Userspace fills SQEs and publishes them by advancing sq_tail, then calls
+ * ASYNC_KICK; a kernel worker consumes them, appends a CQE per request,
+ * advances cq_tail and signals the eventfd. Userspace advances cq_head once
+ * it has read a CQE. Every index is free running; use it modulo the entry
+ * count. Each side writes only its own indexes, with release ordering.
+ */
+struct vencrypt_async_setup {
+    __u32 sq_entries;  // in: power of two, up to VENCRYPT_ASYNC_MAX
+    __u32 cq_entries;  // in: power of two, at least sq_entries
+    __s32 eventfd;     // in: eventfd to signal on completion, or -1
+    __u32 reserved;    // must be 0
+    __u64 sq_off;      // out: byte offset of the SQE array in the mapping
+    __u64 cq_off;      // out: byte offset of the CQE array
+    __u64 size;        // out: bytes to map
+};
+
+// At offset 0 of the async mapping
+struct vencrypt_async_ring {
+    __u32 sq_head;     // kernel
+    __u32 sq_tail;     // user
+    __u32 cq_head;     // user
+    __u32 cq_tail;     // kernel
+};
+
+struct vencrypt_sqe {
+    struct vencrypt_item item;  // status and tag are ignored here
+    __u64 user_data;            // echoed in the CQE
+};
+
+struct vencrypt_cqe {
+    __u64 user_data;
+    __s32 status;      // 0 or a negative errno
+    __u32 reserved;
+    __u8 tag[16];      // GCM encrypt: the tag
+};
+
+#define VENCRYPT_ASYNC_MAX 4096
+#define VENCRYPT_MMAP_ASYNC 0x10000000ULL
+
+struct vencrypt_tag {
+    __u8 tag[16];
+};
+
+// A raw key for the device's key table
+struct vencrypt_key {
+    __u8 key[64];      // AES-128/192/256, or an XTS pair of two AES keys
+    __u32 key_len;     // 16, 24, 32, 48 or 64
+    __u32 handle;      // out: names the key for KEY_USE and KEY_DROP
+};
+
+/*
+ * Text armor for the ciphertext side of a stream: read() hands encryption
+ * output out as hex or base64, write() takes decryption input that way.
+ * Hex is lowercase on output and either case on input. Base64 is RFC 4648
+ * with '=' padding on the last group; input may leave the padding off, but
+ * nothing may follow it. Line breaks and whitespace are not accepted.
+ * PROCESS_RANGE, BATCH and async requests always work on raw bytes.
+ */
+#define VENCRYPT_ARMOR_NONE 0
+#define VENCRYPT_ARMOR_HEX 1
+#define VENCRYPT_ARMOR_BASE64 2
+
+// Hex key, same format as the sysfs "key" file; 64 or 128 hex digits also key XTS
+#define VENCRYPT_IOCTL_SET_KEY _IOW('v', 0, char*)
+// 1 to encrypt, 0 to decrypt; for this open only
+#define VENCRYPT_IOCTL_SET_ENCRYPT _IOW('v', 1, int)
+// CBC/CTR: 16 bytes. XTS: 16-byte LE first sector. GCM: 12-byte nonce. Before any data
+#define VENCRYPT_IOCTL_SET_IV _IOW('v', 2, struct vencrypt_buf)
+// GCM only, once, after SET_IV and before any data
+#define VENCRYPT_IOCTL_SET_AAD _IOW('v', 3, struct vencrypt_buf)
+// GCM encrypt: ends the stream, flushes a partial block and returns the tag
+#define VENCRYPT_IOCTL_GET_TAG _IOR('v', 4, struct vencrypt_tag)
+/*
+ * GCM decrypt: ends the stream and checks the tag, -EBADMSG on mismatch.
+ * Plaintext is not readable until the tag checks out, so a decrypt stream
+ * is capped at the driver's queue depth (queue_depth, else ring_size):
+ * once that much is held back, write() fails with -EMSGSIZE and poll()
+ * reports EPOLLERR. Longer messages go through PROCESS_USER or a batch.
+ */
+#define VENCRYPT_IOCTL_CHECK_TAG _IOW('v', 5, struct vencrypt_tag)
+// Transform a range of the mmap()ed buffer in place; whole blocks (XTS: sectors) except in CTR/GCM
+#define VENCRYPT_IOCTL_PROCESS_RANGE _IOW('v', 6, struct vencrypt_range)
+// Process up to VENCRYPT_BATCH_MAX items; per-item results land in their status field
+#define VENCRYPT_IOCTL_BATCH _IOW('v', 7, struct vencrypt_batch)
+// Once per open: allocate the async rings and register the eventfd
+#define VENCRYPT_IOCTL_ASYNC_SETUP _IOWR('v', 8, struct vencrypt_async_setup)
+// Wake the worker after publishing SQEs; returns at once
+#define VENCRYPT_IOCTL_ASYNC_KICK _IO('v', 9)
+/*
+ * Expand a key once and keep it in the device's table; may evict the least
+ * recently used keys. The handle works from any open by the same effective
+ * user and outlives this one; other users get -ENOENT for it.
+ */
+#define VENCRYPT_IOCTL_KEY_LOAD _IOWR('v', 10, struct vencrypt_key)
+// Switch this open to a table key by handle, with no key expansion; -ENOENT if evicted
+#define VENCRYPT_IOCTL_KEY_USE _IOW('v', 11, __u32)
+// Remove a key from the table; opens using it keep it until they switch or close
+#define VENCRYPT_IOCTL_KEY_DROP _IOW('v', 12, __u32)
+// VENCRYPT_ARMOR_*, by value like SET_ENCRYPT; for this open only, before any data
+#define VENCRYPT_IOCTL_SET_ARMOR _IOW('v', 13, int)
+// PROCESS_RANGE on the caller's own memory, which is pinned and ciphered in place; for very large buffers
+#define VENCRYPT_IOCTL_PROCESS_USER _IOW('v', 14, struct vencrypt_span)
+
+#endif /* _VENCRYPT_H */